@@ -2,9 +2,13 @@ import io
 import sys
 import json
 import random
-import time
 import signal
 
+try:
+    import msgpack
+except ImportError:
+    msgpack = None
+
 class Vec:
     def __init__(self, x = 0.0, y = 0.0):
         self.x = x
@@ -122,15 +126,79 @@ def dump_query_request(action):
     json['params'] = [action.obj_id]
     return json
 
+def make_request(fn, params = None, req_id = None):
+    req = [fn]
+    if params is not None:
+        req.append(params)
+    if req_id is not None:
+        req.append(req_id)
+    return req
+
+class RequestBatch:
+    def __init__(self):
+        self.requests = []
+
+    def add(self, fn, params = None, req_id = None):
+        self.requests.append(make_request(fn, params, req_id))
+
+    def __len__(self):
+        return len(self.requests)
+
+def binary_stream(fd):
+    # Text streams on Python 3 keep the byte stream underneath as buffer.
+    # Whatever they still have buffered has to go out first.
+    out = getattr(fd, 'buffer', None)
+    if out is None:
+        return fd
+    fd.flush()
+    return out
+
+def write_batch(fd, batch):
+    # The engine answers with one array holding a response to every request
+    # in the batch that has an id.
+    if len(batch) == 0:
+        return
+    if msgpack is None:
+        raise RuntimeError('write_batch needs the msgpack package')
+    out = binary_stream(fd)
+    out.write(msgpack.packb(batch.requests, use_bin_type=True))
+    out.flush()
+    batch.requests = []
+
+class Response:
+    def __init__(self, fn, result, req_id, is_error = False):
+        self.fn = fn
+        self.result = result
+        self.req_id = req_id
+        self.is_error = is_error
+
+def parse_response(res):
+    # Errors have a trailing true: [fn, [code, msg], id, true]
+    return Response(res[0], res[1], res[2], len(res) > 3 and res[3])
+
+def parse_responses(frame):
+    # A frame is either a single response or an array of them, as the answer
+    # to a batch.
+    if len(frame) > 0 and isinstance(frame[0], (list, tuple)):
+        return [parse_response(res) for res in frame]
+    return [parse_response(frame)]
+
 def wait_for_header(fd):
     header = fd.read(3)
     if header != 'PpM':
         sys.exit(2)
 
+def announce_ready(fd):
+    # Pooled plugins are started ahead of time, the engine waits for this
+    # before it hands us out.
+    fd.write('PpM')
+    fd.flush()
+
 if __name__ == '__main__':
+    if '--pooled' in sys.argv:
+        announce_ready(sys.stdout)
     wait_for_header(sys.stdin)
 
-    time.sleep(1)
     action = ObjectCreationAction(1)
     action.obj.volume.pos.x = 500;
     action.obj.volume.pos.y = 500;
@@ -0,0 +1,130 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "buffer_pool.h"
+#include <algorithm>
+#include <new>
+#include "thread_local.h"
+namespace ug
+{
+  constexpr std::size_t Buffer_Pool::Default_Block_Size;
+  constexpr std::size_t Buffer_Pool::Default_Max_Free;
+
+  Buffer_Pool::Buffer_Pool(std::size_t block_size,
+                           std::size_t max_free) noexcept
+    : block_size_(block_size), max_free_(max_free)
+  {
+    // Releasing never has to grow the free list.
+    free_.reserve(max_free_);
+  }
+  Buffer_Pool::~Buffer_Pool() noexcept
+  {
+    for(char* buf : free_) delete[] buf;
+  }
+
+  char* Buffer_Pool::acquire(std::size_t size) noexcept
+  {
+    ++stats_.acquired;
+
+    if(size > block_size_)
+    {
+      ++stats_.oversized;
+      return new char[size];
+    }
+
+    ++stats_.in_use;
+    stats_.peak_in_use = std::max(stats_.peak_in_use, stats_.in_use);
+
+    if(free_.empty())
+    {
+      ++stats_.allocated;
+      return new char[block_size_];
+    }
+
+    char* buf = free_.back();
+    free_.pop_back();
+    return buf;
+  }
+  void Buffer_Pool::release(char* buf, std::size_t size) noexcept
+  {
+    if(!buf) return;
+
+    if(size > block_size_)
+    {
+      delete[] buf;
+      return;
+    }
+
+    --stats_.in_use;
+
+    if(free_.size() < max_free_) free_.push_back(buf);
+    else delete[] buf;
+  }
+
+  namespace
+  {
+    UG_THREAD_LOCAL bool thread_exiting_ = false;
+
+    // Empties the pools a thread made once it exits.
+    struct Thread_Pools
+    {
+      ~Thread_Pools() noexcept
+      {
+        thread_exiting_ = true;
+        for(Buffer_Pool* pool : pools)
+        {
+          // Blocks may still be in flight, the pool has to stay usable. One
+          // that keeps nothing doesn't allocate, so it can't leak.
+          std::size_t block_size = pool->block_size();
+          pool->~Buffer_Pool();
+          new (pool) Buffer_Pool{block_size, 0};
+        }
+      }
+
+      std::vector<Buffer_Pool*> pools;
+    };
+
+    UG_THREAD_LOCAL Thread_Pool_Storage io_pool_storage_;
+    UG_THREAD_LOCAL Buffer_Pool* io_pool_ = nullptr;
+  }
+
+  Buffer_Pool* make_thread_pool(Thread_Pool_Storage& storage,
+                                std::size_t block_size,
+                                std::size_t max_free) noexcept
+  {
+    // Too late to be emptied, so don't keep anything to begin with.
+    if(thread_exiting_) return new (&storage) Buffer_Pool{block_size, 0};
+
+    static thread_local Thread_Pools pools;
+    Buffer_Pool* pool = new (&storage) Buffer_Pool{block_size, max_free};
+    pools.pools.push_back(pool);
+    return pool;
+  }
+
+  Buffer_Pool& io_buffer_pool() noexcept
+  {
+    if(!io_pool_)
+    {
+      io_pool_ = make_thread_pool(io_pool_storage_,
+                                  Buffer_Pool::Default_Block_Size,
+                                  Buffer_Pool::Default_Max_Free);
+    }
+    return *io_pool_;
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+namespace ug
+{
+  struct Buffer_Pool_Stats
+  {
+    // Blocks handed out so far.
+    std::size_t acquired = 0;
+    // How many of those had to be allocated because none were free.
+    std::size_t allocated = 0;
+    // Requests too big for a block, these are allocated and freed every time.
+    std::size_t oversized = 0;
+    // Blocks currently handed out.
+    std::size_t in_use = 0;
+    std::size_t peak_in_use = 0;
+  };
+
+  /*!
+   * \brief Free list of fixed size blocks.
+   *
+   * Released blocks are kept for the next acquire, up to a limit, so a steady
+   * stream of short lived buffers doesn't touch the heap. Not thread safe.
+   */
+  struct Buffer_Pool
+  {
+    static constexpr std::size_t Default_Block_Size = 64 * 1024;
+    static constexpr std::size_t Default_Max_Free = 64;
+
+    explicit Buffer_Pool(std::size_t block_size = Default_Block_Size,
+                         std::size_t max_free = Default_Max_Free) noexcept;
+    ~Buffer_Pool() noexcept;
+
+    Buffer_Pool(Buffer_Pool const&) = delete;
+    Buffer_Pool& operator=(Buffer_Pool const&) = delete;
+
+    /*!
+     * \brief Returns a buffer of at least size bytes.
+     *
+     * Sizes bigger than the block size still work, they just aren't pooled.
+     */
+    char* acquire(std::size_t size) noexcept;
+
+    /*!
+     * \brief Gives back a buffer, size must be the one it was acquired with.
+     */
+    void release(char* buf, std::size_t size) noexcept;
+
+    inline std::size_t block_size() const noexcept;
+    inline std::size_t free_blocks() const noexcept;
+    inline Buffer_Pool_Stats const& stats() const noexcept;
+  private:
+    std::size_t block_size_;
+    std::size_t max_free_;
+    std::vector<char*> free_;
+    Buffer_Pool_Stats stats_;
+  };
+
+  inline std::size_t Buffer_Pool::block_size() const noexcept
+  {
+    return block_size_;
+  }
+  inline std::size_t Buffer_Pool::free_blocks() const noexcept
+  {
+    return free_.size();
+  }
+  inline Buffer_Pool_Stats const& Buffer_Pool::stats() const noexcept
+  {
+    return stats_;
+  }
+
+  // Where a thread's pool lives, see make_thread_pool.
+  using Thread_Pool_Storage =
+    std::aligned_storage_t<sizeof(Buffer_Pool), alignof(Buffer_Pool)>;
+
+  /*!
+   * \brief Makes the calling thread's pool in storage, which must be thread
+   * local.
+   *
+   * The blocks the pool kept are freed when the thread exits. From then on
+   * it keeps none, so blocks still in flight are freed as they come back.
+   */
+  Buffer_Pool* make_thread_pool(Thread_Pool_Storage& storage,
+                                std::size_t block_size,
+                                std::size_t max_free) noexcept;
+
+  /*!
+   * \brief The pool io read buffers come from, one for each thread.
+   */
+  Buffer_Pool& io_buffer_pool() noexcept;
+}
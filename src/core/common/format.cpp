@@ -0,0 +1,153 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "format.h"
+#include <cstdio>
+namespace ug
+{
+  Format_Template::Format_Template(std::string s) noexcept
+    : str(std::move(s))
+  {
+    for(std::size_t pos = 0; (pos = str.find('%', pos)) != std::string::npos;
+        ++pos)
+    {
+      holes.push_back(pos);
+    }
+  }
+
+  void to_format_arg(Format_Arg& arg, std::string const& str) noexcept
+  {
+    arg.data = str.data();
+    arg.size = str.size();
+  }
+  void to_format_arg(Format_Arg& arg, char const* str) noexcept
+  {
+    arg.data = str;
+    arg.size = std::strlen(str);
+  }
+
+  namespace
+  {
+    constexpr char Digit_Pairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233"
+      "34353637383940414243444546474849505152535455565758596061626364656667"
+      "6869707172737475767778798081828384858687888990919293949596979899";
+
+    // Writes v backwards ending at end, returns where it starts.
+    char* write_digits(char* end, unsigned long long v) noexcept
+    {
+      // Two digits at a time saves half the divisions.
+      while(v >= 100)
+      {
+        unsigned int pair = (v % 100) * 2;
+        v /= 100;
+        *--end = Digit_Pairs[pair + 1];
+        *--end = Digit_Pairs[pair];
+      }
+      if(v >= 10)
+      {
+        unsigned int pair = v * 2;
+        *--end = Digit_Pairs[pair + 1];
+        *--end = Digit_Pairs[pair];
+      }
+      else
+      {
+        *--end = '0' + v;
+      }
+      return end;
+    }
+  }
+
+  void format_signed(Format_Arg& arg, long long v) noexcept
+  {
+    char* end = arg.buf + sizeof(arg.buf);
+    // Negating the smallest value overflows, so negate after converting.
+    unsigned long long magnitude = v < 0 ? 0ull - (unsigned long long) v : v;
+    char* begin = write_digits(end, magnitude);
+    if(v < 0) *--begin = '-';
+
+    arg.data = begin;
+    arg.size = end - begin;
+  }
+  void format_unsigned(Format_Arg& arg, unsigned long long v) noexcept
+  {
+    char* end = arg.buf + sizeof(arg.buf);
+    char* begin = write_digits(end, v);
+
+    arg.data = begin;
+    arg.size = end - begin;
+  }
+  void format_double(Format_Arg& arg, double v) noexcept
+  {
+    int size = std::snprintf(arg.buf, sizeof(arg.buf), "%f", v);
+    if(size >= 0 && (std::size_t) size < sizeof(arg.buf))
+    {
+      arg.data = arg.buf;
+      arg.size = size;
+      return;
+    }
+    arg.big = std::to_string(v);
+    arg.data = arg.big.data();
+    arg.size = arg.big.size();
+  }
+
+  namespace
+  {
+    std::size_t args_size(Format_Arg const* args, std::size_t count) noexcept
+    {
+      std::size_t size = 0;
+      for(std::size_t i = 0; i < count; ++i) size += args[i].size;
+      return size;
+    }
+  }
+
+  void format_into(std::string& out, Format_View str,
+                   Format_Arg const* args, std::size_t count) noexcept
+  {
+    out.reserve(out.size() + str.size + args_size(args, count));
+
+    char const* pos = str.data;
+    char const* end = str.data + str.size;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+      char const* hole = (char const*) std::memchr(pos, '%', end - pos);
+      if(!hole) break;
+
+      out.append(pos, hole - pos);
+      out.append(args[i].data, args[i].size);
+      pos = hole + 1;
+    }
+    out.append(pos, end - pos);
+  }
+  void format_into(std::string& out, Format_Template const& str,
+                   Format_Arg const* args, std::size_t count) noexcept
+  {
+    out.reserve(out.size() + str.str.size() + args_size(args, count));
+
+    std::size_t pos = 0;
+    for(std::size_t i = 0; i < count && i < str.holes.size(); ++i)
+    {
+      std::size_t hole = str.holes[i];
+      out.append(str.str, pos, hole - pos);
+      out.append(args[i].data, args[i].size);
+      pos = hole + 1;
+    }
+    out.append(str.str, pos, std::string::npos);
+  }
+}
@@ -0,0 +1,146 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+namespace ug
+{
+  /*!
+   * \brief A format string, without copying it.
+   *
+   * Each % in it is replaced by the next argument. Placeholders left over
+   * are written as they are, arguments left over are ignored.
+   */
+  struct Format_View
+  {
+    /* implicit */ Format_View(char const* str) noexcept
+      : data(str), size(std::strlen(str)) {}
+    /* implicit */ Format_View(std::string const& str) noexcept
+      : data(str.data()), size(str.size()) {}
+    Format_View(char const* data, std::size_t size) noexcept
+      : data(data), size(size) {}
+
+    char const* data;
+    std::size_t size;
+  };
+
+  /*!
+   * \brief A format string that is split up at its placeholders once, for
+   * formatting it many times.
+   */
+  struct Format_Template
+  {
+    Format_Template() noexcept {}
+    explicit Format_Template(std::string str) noexcept;
+
+    std::string str;
+    // Where each placeholder is in str.
+    std::vector<std::size_t> holes;
+  };
+
+  /*!
+   * \brief An argument turned into text, before anything is written.
+   *
+   * Knowing every argument's size up front means the output only has to
+   * grow once.
+   */
+  struct Format_Arg
+  {
+    char const* data = nullptr;
+    std::size_t size = 0;
+
+    // Numbers are written here,
+    char buf[32];
+    // unless they are doubles too big for it.
+    std::string big;
+  };
+
+  void to_format_arg(Format_Arg& arg, std::string const& str) noexcept;
+  void to_format_arg(Format_Arg& arg, char const* str) noexcept;
+
+  void format_signed(Format_Arg& arg, long long v) noexcept;
+  void format_unsigned(Format_Arg& arg, unsigned long long v) noexcept;
+  // Like std::to_string, six digits after the point.
+  void format_double(Format_Arg& arg, double v) noexcept;
+
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_signed<T>::value>::type
+    to_format_arg(Format_Arg& arg, T v) noexcept
+  {
+    format_signed(arg, v);
+  }
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_unsigned<T>::value>::type
+    to_format_arg(Format_Arg& arg, T v) noexcept
+  {
+    format_unsigned(arg, v);
+  }
+  template <class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type
+    to_format_arg(Format_Arg& arg, T v) noexcept
+  {
+    format_double(arg, v);
+  }
+
+  // Append to out, which is only grown once.
+  void format_into(std::string& out, Format_View str,
+                   Format_Arg const* args, std::size_t count) noexcept;
+  void format_into(std::string& out, Format_Template const& str,
+                   Format_Arg const* args, std::size_t count) noexcept;
+
+  /*!
+   * \brief Appends the formatted string to out.
+   *
+   * The format is read once, front to back. Arguments are turned into text
+   * on the stack first.
+   */
+  template <class Format, class... Args>
+  void format_to(std::string& out, Format const& str,
+                 Args&&... args) noexcept
+  {
+    // One more so it's never empty.
+    Format_Arg list[sizeof...(Args) + 1];
+    std::size_t i = 0;
+    int expand[] = {0, (to_format_arg(list[i++], args), 0)...};
+    (void) expand;
+
+    format_into(out, str, list, sizeof...(Args));
+  }
+
+  template <class... Args>
+  std::string format_str(Format_View str, Args&&... args) noexcept
+  {
+    std::string out;
+    format_to(out, str, std::forward<Args>(args)...);
+    return out;
+  }
+  template <class... Args>
+  std::string format(Format_Template const& str, Args&&... args) noexcept
+  {
+    std::string out;
+    format_to(out, str, std::forward<Args>(args)...);
+    return out;
+  }
+}
@@ -18,11 +18,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "log.h"
-#include <string>
-#include <ctime>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
-#include <uv.h>
-#include "thread_local.h"
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "log_binary.h"
+#include "mpsc_ring.hpp"
 namespace ug
 {
   Scoped_Log_Init::Scoped_Log_Init() noexcept
@@ -34,147 +45,547 @@ namespace ug
     uninit_log();
   }
 
-  UG_THREAD_LOCAL uv_loop_t* loop_ = nullptr;
-  Log_Severity out_level_ = Log_Severity::Info;
+  namespace
+  {
+    // Messages that can be waiting for the writer before we start dropping
+    // them.
+    constexpr std::size_t Log_Capacity = 4096;
+    // Messages written with each writev.
+    constexpr std::size_t Log_Batch = 64;
+
+    struct Log_Record
+    {
+      Log_Severity severity;
+      // The site of a binary message, whose msg is its packed arguments.
+      // Zero for text.
+      unsigned int site;
+      // Since the epoch.
+      std::int64_t ns;
+      std::string msg;
+    };
+
+    constexpr std::int64_t Ns_Per_Sec = 1000000000;
+
+    struct Log_State
+    {
+      Log_State() noexcept : ring(Log_Capacity) {}
+
+      Mpsc_Ring<Log_Record> ring;
+
+      std::thread writer;
+      std::atomic<bool> stop{false};
+      std::atomic<bool> sleeping{false};
+      // Records popped and written by the writer.
+      std::atomic<std::size_t> written{0};
+
+      std::mutex mutex;
+      std::condition_variable wake;
+      std::condition_variable flushed;
+    };
+
+    // Allocated by the first init_log and kept around, a thread that checked
+    // running_ just before the log went down may still push to it.
+    Log_State* state_ = nullptr;
+    std::atomic<bool> running_{false};
+    // Guards init and uninit, nothing else.
+    std::mutex init_mutex_;
+    int init_count_ = 0;
+
+    std::atomic<std::size_t> dropped_{0};
+
+    // Held by the writer while it writes, so the file isn't swapped out from
+    // under it.
+    std::mutex out_mutex_;
+    int out_fd_ = STDOUT_FILENO;
+    // Bumped when the output changes, binary logs start over with a header.
+    unsigned int out_generation_ = 1;
+
+    // Sites are statics, so they are never removed.
+    struct Site_Registry
+    {
+      std::mutex mutex;
+      std::vector<Log_Site const*> sites;
+    };
+    // Sites may be reached during static initialization.
+    Site_Registry& site_registry() noexcept
+    {
+      static Site_Registry registry;
+      return registry;
+    }
+
+    // Appends to a string, for use as the stream of a msgpack::packer.
+    struct String_Stream
+    {
+      std::string& str;
+
+      void write(char const* data, std::size_t size) noexcept
+      {
+        str.append(data, size);
+      }
+    };
+
+    // Everything around a message but the time, for each severity.
+    struct Severity_Format
+    {
+      char const* open;
+      char const* label;
+    };
+    constexpr char const* const RESET_C = "\x1b[0m\n";
+    constexpr Severity_Format Formats[] =
+    {
+      {"\x1b[96m(", "): debug: "},
+      {"\x1b[92m(", "): info: "},
+      {"\x1b[91m(", "): warning: "},
+      {"\x1b[95m(", "): error: "},
+    };
+
+    // Only formatted again when the second changes.
+    struct Time_Cache
+    {
+      std::time_t time = -1;
+      char text[32];
+      std::size_t size = 0;
+    };
+    void format_time(Time_Cache& cache, std::time_t t) noexcept
+    {
+      std::tm tm;
+      localtime_r(&t, &tm);
+      cache.time = t;
+      cache.size = std::strftime(cache.text, sizeof(cache.text), "%F|%T", &tm);
+      if(cache.size == 0)
+      {
+        std::strcpy(cache.text, "badtime");
+        cache.size = std::strlen(cache.text);
+      }
+    }
+
+    iovec make_iovec(char const* data, std::size_t size) noexcept
+    {
+      return iovec{(void*) data, size};
+    }
+    iovec make_iovec(char const* str) noexcept
+    {
+      return make_iovec(str, std::strlen(str));
+    }
+
+    // Hold out_mutex_ for this. A whole batch goes out with one writev from
+    // the writer thread, an io_uring would still cost an io_uring_enter per
+    // batch, so the log doesn't use one.
+    void write_iovs(iovec* iov, int count) noexcept
+    {
+      while(count)
+      {
+        ssize_t written = writev(out_fd_, iov, count);
+        if(written < 0)
+        {
+          if(errno == EINTR) continue;
+          // Nowhere to complain.
+          break;
+        }
+        // Skip what was written, then go again for the rest.
+        while(count && (std::size_t) written >= iov->iov_len)
+        {
+          written -= iov->iov_len;
+          ++iov;
+          --count;
+        }
+        if(count)
+        {
+          iov->iov_base = (char*) iov->iov_base + written;
+          iov->iov_len -= written;
+        }
+      }
+    }
+    void write_all(std::vector<iovec>& iovs) noexcept
+    {
+      if(iovs.empty()) return;
+      std::lock_guard<std::mutex> lock{out_mutex_};
+      write_iovs(iovs.data(), iovs.size());
+      iovs.clear();
+    }
+
+    // Everything the writer keeps between batches.
+    struct Writer
+    {
+      Time_Cache time;
+      std::vector<Log_Record> batch;
+      std::vector<iovec> iovs;
+
+      // Binary records are packed here first.
+      std::string out;
+      // The output the last binary header went to and the sites written to
+      // it since.
+      unsigned int generation = 0;
+      std::vector<bool> defined;
+    };
+
+    // A binary message that ends up in a text log is formatted here.
+    void format_binary(Log_Record& rec) noexcept
+    {
+      std::string msg;
+      if(Log_Site const* site = find_log_site(rec.site))
+      {
+        try
+        {
+          msgpack::unpacked args;
+          msgpack::unpack(args, rec.msg.data(), rec.msg.size());
+          format_log_args(msg, site->format, args.get());
+        }
+        catch(std::exception&) {}
+      }
+      rec.msg = std::move(msg);
+      rec.site = 0;
+    }
+
+    void write_text(Writer& w, std::size_t count) noexcept
+    {
+      for(std::size_t i = 0; i < count; ++i)
+      {
+        Log_Record& rec = w.batch[i];
+        if(rec.site) format_binary(rec);
+
+        std::time_t time = rec.ns / Ns_Per_Sec;
+        if(time != w.time.time)
+        {
+          // Entries so far point at the cached time.
+          write_all(w.iovs);
+          format_time(w.time, time);
+        }
+
+        Severity_Format const& fmt = Formats[(unsigned int) rec.severity];
+        w.iovs.push_back(make_iovec(fmt.open));
+        w.iovs.push_back(make_iovec(w.time.text, w.time.size));
+        w.iovs.push_back(make_iovec(fmt.label));
+        w.iovs.push_back(make_iovec(rec.msg.data(), rec.msg.size()));
+        w.iovs.push_back(make_iovec(RESET_C));
+      }
+      write_all(w.iovs);
+    }
+
+    void write_binary(Writer& w, std::size_t count) noexcept
+    {
+      String_Stream stream{w.out};
+      msgpack::packer<String_Stream> packer(stream);
+
+      // The output can't change from under the header.
+      std::lock_guard<std::mutex> lock{out_mutex_};
+      if(w.generation != out_generation_)
+      {
+        w.generation = out_generation_;
+        w.defined.clear();
+
+        packer.pack_array(3);
+        packer.pack((unsigned int) Log_Record_Kind::Header);
+        packer.pack(Binary_Log_Magic);
+        packer.pack(Binary_Log_Version);
+      }
+
+      for(std::size_t i = 0; i < count; ++i)
+      {
+        Log_Record const& rec = w.batch[i];
+        if(!rec.site)
+        {
+          packer.pack_array(4);
+          packer.pack((unsigned int) Log_Record_Kind::Text);
+          packer.pack(rec.ns);
+          packer.pack((unsigned int) rec.severity);
+          packer.pack(rec.msg);
+          continue;
+        }
+
+        if(w.defined.size() <= rec.site) w.defined.resize(rec.site + 1);
+        if(!w.defined[rec.site])
+        {
+          Log_Site const& site = *find_log_site(rec.site);
+          packer.pack_array(7);
+          packer.pack((unsigned int) Log_Record_Kind::Site);
+          packer.pack(site.id);
+          packer.pack((unsigned int) site.severity);
+          packer.pack((unsigned int) site.subsystem);
+          packer.pack(site.format);
+          packer.pack(site.file);
+          packer.pack(site.line);
+          w.defined[rec.site] = true;
+        }
+
+        packer.pack_array(5);
+        packer.pack((unsigned int) Log_Record_Kind::Message);
+        packer.pack(rec.ns);
+        packer.pack((unsigned int) rec.severity);
+        packer.pack(rec.site);
+        // Already packed as an array.
+        w.out.append(rec.msg);
+      }
+
+      iovec iov = make_iovec(w.out.data(), w.out.size());
+      write_iovs(&iov, 1);
+      w.out.clear();
+    }
+
+    // Writes what's queued, returns how many messages there were.
+    std::size_t write_batch(Log_State& s, Writer& w) noexcept
+    {
+      w.batch.resize(Log_Batch);
+      std::size_t count = 0;
+      while(count < Log_Batch && s.ring.pop(w.batch[count])) ++count;
+      if(!count) return 0;
+
+      if(log_format() == Log_Format::Binary) write_binary(w, count);
+      else write_text(w, count);
+
+      for(std::size_t i = 0; i < count; ++i) w.batch[i].msg.clear();
+      s.written.fetch_add(count, std::memory_order_release);
+      // Taking the lock makes sure a flush_log_full about to wait doesn't
+      // miss this.
+      { std::lock_guard<std::mutex> lock{s.mutex}; }
+      s.flushed.notify_all();
+      return count;
+    }
+
+    void write_loop(Log_State& s) noexcept
+    {
+      Writer w;
+      w.iovs.reserve(Log_Batch * 5);
+
+      while(true)
+      {
+        if(write_batch(s, w)) continue;
+        if(s.stop.load()) break;
+
+        std::unique_lock<std::mutex> lock{s.mutex};
+        s.sleeping.store(true);
+        // Pairs with the fence in push, either the producer sees us asleep
+        // and wakes us or we see its value here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s.wake.wait(lock, [&]()
+        {
+          return s.ring.pushed() != s.ring.popped() || s.stop.load();
+        });
+        s.sleeping.store(false);
+      }
+    }
+
+    void push(Log_Severity severity, unsigned int site,
+              std::string&& msg) noexcept
+    {
+      if(!running_.load(std::memory_order_acquire)) return;
+
+      Log_State& s = *state_;
+      auto now = std::chrono::system_clock::now().time_since_epoch();
+      Log_Record rec{severity, site,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+        std::move(msg)};
+      if(!s.ring.push(std::move(rec)))
+      {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      // The writer only sleeps on an empty ring, so this is the push that
+      // made it non-empty. Taking the lock makes sure the writer is either
+      // still about to check the ring or already waiting.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(s.sleeping.load(std::memory_order_relaxed))
+      {
+        { std::lock_guard<std::mutex> lock{s.mutex}; }
+        s.wake.notify_one();
+      }
+    }
+  }
 
   void init_log() noexcept
   {
-    if(loop_) return;
+    std::lock_guard<std::mutex> lock{init_mutex_};
+    if(init_count_++) return;
 
-    loop_ = new uv_loop_t;
-    uv_loop_init(loop_);
+    if(!state_) state_ = new Log_State;
+    state_->stop.store(false);
+    state_->writer = std::thread{write_loop, std::ref(*state_)};
+    running_.store(true, std::memory_order_release);
   }
   void uninit_log() noexcept
   {
-    if(!loop_) return;
+    std::lock_guard<std::mutex> lock{init_mutex_};
+    if(!init_count_ || --init_count_) return;
 
-    uv_loop_close(loop_);
-    delete loop_;
+    // The writer drains the ring before it notices.
+    running_.store(false);
+    state_->stop.store(true);
+    // The writer waits without a timeout, so it mustn't miss this.
+    { std::lock_guard<std::mutex> lock{state_->mutex}; }
+    state_->wake.notify_one();
+    state_->writer.join();
   }
   void flush_log() noexcept
   {
-    uv_run(loop_, UV_RUN_NOWAIT);
+    if(!running_.load(std::memory_order_acquire)) return;
+    state_->wake.notify_one();
   }
   void flush_log_full() noexcept
   {
-    uv_run(loop_, UV_RUN_DEFAULT);
-  }
+    if(!running_.load(std::memory_order_acquire)) return;
 
-  void set_out_log_level(Log_Severity level) noexcept
-  {
-    // TODO: Add a mutex or something so we don't get that 1-in-1000000 data
-    // race. TODO On second thought if this ever comes up in practice by a
-    // lotto ticket!
-    out_level_ = level;
+    Log_State& s = *state_;
+    std::size_t target = s.ring.pushed();
+
+    std::unique_lock<std::mutex> lock{s.mutex};
+    s.wake.notify_one();
+    s.flushed.wait(lock, [&]()
+    {
+      return s.written.load(std::memory_order_acquire) >= target ||
+             s.stop.load();
+    });
   }
 
-  std::string format_time(const std::string& format)
+  void set_log_filename(char const* const filename) noexcept
   {
-    // Stringify current time.
-    std::string time;
-    time.resize(25);
-
-    std::time_t t = std::time(NULL);
-    std::size_t count = std::strftime(&time[0], time.size(),
-                                      format.c_str(), std::localtime(&t));
-    if(count == 0)
+    int fd = STDOUT_FILENO;
+    if(filename)
     {
-      time = "badtime";
+      fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if(fd < 0) return;
     }
 
-    time.resize(count);
-    return time;
+    std::lock_guard<std::mutex> lock{out_mutex_};
+    if(out_fd_ != STDOUT_FILENO) close(out_fd_);
+    out_fd_ = fd;
+    ++out_generation_;
   }
 
-  struct write_req_t
+  void set_log_format(Log_Format format) noexcept
   {
-    uv_fs_t req;
-    uv_buf_t buf;
-  };
+    detail::log_format.store(format, std::memory_order_relaxed);
+  }
 
-  void after_log(uv_fs_t* fs_req)
+  void append_log_line(std::string& out, Log_Severity severity,
+                       std::time_t time, Format_View msg) noexcept
   {
-    write_req_t* req = (write_req_t*) fs_req;
+    Time_Cache cache;
+    format_time(cache, time);
 
-    // Uninitialize actual uv request.
-    uv_fs_req_cleanup(&req->req);
-
-    // Deallocate buffer.
-    delete[] req->buf.base;
+    Severity_Format const& fmt = Formats[(unsigned int) severity];
+    out.append(fmt.open);
+    out.append(cache.text, cache.size);
+    out.append(fmt.label);
+    out.append(msg.data, msg.size);
+    out.append(RESET_C);
+  }
 
-    // Deallocate request subclass.
-    delete req;
+  Log_Site::Log_Site(char const* format, Log_Severity severity,
+                     Log_Subsystem subsystem, char const* file,
+                     unsigned int line) noexcept
+    : format(format), severity(severity), subsystem(subsystem), file(file),
+      line(line)
+  {
+    Site_Registry& registry = site_registry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.sites.push_back(this);
+    // Zero is left for text messages.
+    id = registry.sites.size();
+  }
+  Log_Site const* find_log_site(unsigned int id) noexcept
+  {
+    Site_Registry& registry = site_registry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    if(id == 0 || id > registry.sites.size()) return nullptr;
+    return registry.sites[id - 1];
   }
 
-  void log(std::string severity, std::string msg,
-           char const* const before, char const* const after,
-           int severity_level) noexcept
+  namespace detail
   {
-    if(!loop_) return;
+    std::atomic<Log_Severity> log_levels[Log_Subsystem_Count] =
+    {
+      {Log_Severity::Info}, {Log_Severity::Info}, {Log_Severity::Info},
+      {Log_Severity::Info}, {Log_Severity::Info}
+    };
+    std::atomic<Log_Format> log_format{Log_Format::Text};
+  }
 
-    // Bail out if the severity level isn't enough
-    if(severity_level > (int) out_level_)
+  void set_out_log_level(Log_Severity level) noexcept
+  {
+    for(auto& subsystem_level : detail::log_levels)
     {
-      // Get outta here!
-      return;
+      subsystem_level.store(level, std::memory_order_relaxed);
     }
+  }
+  Log_Severity out_log_level() noexcept
+  {
+    return log_level(Log_Subsystem::General);
+  }
+  void set_log_level(Log_Subsystem subsystem, Log_Severity level) noexcept
+  {
+    detail::log_levels[(unsigned int) subsystem]
+      .store(level, std::memory_order_relaxed);
+  }
+  Log_Severity log_level(Log_Subsystem subsystem) noexcept
+  {
+    return detail::log_levels[(unsigned int) subsystem]
+             .load(std::memory_order_relaxed);
+  }
 
-    // Create the final message.
-    std::string time = format_time("%F|%T");
-    std::string final_msg = std::string{before} + "(" + time + "): " +
-                            severity + ": " + msg + std::string{after} + "\n";
-
-    // Copy to a buffer libuv can use.
-    char* msg_data = new char[final_msg.size()];
-    std::memcpy(msg_data, final_msg.data(), final_msg.size());
+  std::size_t dropped_log_messages() noexcept
+  {
+    return dropped_.load(std::memory_order_relaxed);
+  }
 
-    // Make the request.
-    write_req_t* req = new write_req_t;
-    req->buf = uv_buf_init(msg_data, final_msg.size());
-    uv_fs_write(loop_, &req->req, 1, &req->buf, 1, -1, after_log);
+  void log(Log_Severity severity, Log_Subsystem subsystem,
+           std::string msg) noexcept
+  {
+    // Bail out if the severity level isn't enough.
+    if(!log_enabled(severity, subsystem)) return;
+    push(severity, 0, std::move(msg));
   }
-  void log(Log_Severity severity, std::string msg) noexcept
+  void log_binary(Log_Site const& site, Log_Value const* values,
+                  std::size_t count) noexcept
   {
-    // This could be implemented differently, for instance with a
-    // enum-to-string function + calling the log(string,string) function
-    // directly.
-    switch(severity)
+    // Don't bother packing what would be dropped.
+    if(!running_.load(std::memory_order_acquire)) return;
+
+    std::string msg;
+    String_Stream stream{msg};
+    msgpack::packer<String_Stream> packer(stream);
+    packer.pack_array(count);
+    for(std::size_t i = 0; i < count; ++i)
     {
-      case Log_Severity::Error:
-        log_e(msg);
+      Log_Value const& val = values[i];
+      switch(val.kind)
+      {
+      case Log_Value::Kind::Signed:
+        packer.pack(val.i);
+        break;
+      case Log_Value::Kind::Unsigned:
+        packer.pack(val.u);
         break;
-      case Log_Severity::Warning:
-        log_w(msg);
+      case Log_Value::Kind::Double:
+        packer.pack(val.d);
         break;
-      case Log_Severity::Info:
-        log_i(msg);
+      case Log_Value::Kind::String:
+        packer.pack_str(val.size);
+        packer.pack_str_body(val.str, val.size);
         break;
-      case Log_Severity::Debug:
-        log_d(msg);
+      }
     }
+    push(site.severity, site.id, std::move(msg));
+  }
+  void log(Log_Severity severity, std::string msg) noexcept
+  {
+    log(severity, Log_Subsystem::General, std::move(msg));
   }
-
-  constexpr char const* const RESET_C = "\x1b[0m";
-  constexpr char const* const ERROR_C = "\x1b[95m";
-  constexpr char const* const WARNING_C = "\x1b[91m";
-  constexpr char const* const INFO_C = "\x1b[92m";
-  constexpr char const* const DEBUG_C = "\x1b[96m";
 
   void log_e(std::string msg) noexcept
   {
-    log("error", msg, ERROR_C, RESET_C, static_cast<int>(Log_Severity::Error));
+    log(Log_Severity::Error, std::move(msg));
   }
   void log_w(std::string msg) noexcept
   {
-    log("warning", msg, WARNING_C, RESET_C, static_cast<int>(Log_Severity::Warning));
+    log(Log_Severity::Warning, std::move(msg));
   }
   void log_i(std::string msg) noexcept
   {
-    log("info", msg, INFO_C, RESET_C, static_cast<int>(Log_Severity::Info));
+    log(Log_Severity::Info, std::move(msg));
   }
   void log_d(std::string msg) noexcept
   {
-    log("debug", msg, DEBUG_C, RESET_C, static_cast<int>(Log_Severity::Debug));
+    log(Log_Severity::Debug, std::move(msg));
   }
 }
 BEGIN_FORMATTER_SCOPE
@@ -18,27 +18,85 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <atomic>
+#include <cstring>
+#include <ctime>
 #include <string>
+#include <type_traits>
 #include "translate.h"
 #include "pif/helper.h"
 
-// We make this a macro so we can just not do it should it become something we
-// don't want to be doing for some reason. Performance or IO bottleneck for
-// example.
-#ifndef UG_DISABLE_LOGGING
-  #define UG_LOG_ATTEMPT_INIT() init_log()
+/*
+ * Messages less severe than UG_LOG_MIN_SEVERITY are compiled out: the macros
+ * below expand to nothing for them, so their arguments are never evaluated.
+ * 0 keeps everything, 1 drops debug messages, up to 4 which drops them all.
+ * Whatever is left is still checked against the level of its subsystem at
+ * runtime, before anything is formatted.
+ */
+#ifdef UG_DISABLE_LOGGING
+  #undef UG_LOG_MIN_SEVERITY
+  #define UG_LOG_MIN_SEVERITY 4
+#endif
+#ifndef UG_LOG_MIN_SEVERITY
+  #define UG_LOG_MIN_SEVERITY 0
+#endif
+
+#define UG_LOG_FIRST_(...) UG_LOG_FIRST_IMPL_(__VA_ARGS__, unused)
+#define UG_LOG_FIRST_IMPL_(first, ...) first
 
-  #define UG_LOG_E(...) ug::log_e(__VA_ARGS__)
-  #define UG_LOG_W(...) ug::log_w(__VA_ARGS__)
-  #define UG_LOG_I(...) ug::log_i(__VA_ARGS__)
-  #define UG_LOG_D(...) ug::log_d(__VA_ARGS__)
+// The format has to be a string literal, it is registered along with the
+// call site the first time the message is logged.
+#define UG_LOG_AT_(severity, subsystem, ...) \
+  do \
+  { \
+    if(ug::log_enabled(ug::Log_Severity::severity, \
+                       ug::Log_Subsystem::subsystem)) \
+    { \
+      static ug::Log_Site const ug_log_site_{UG_LOG_FIRST_(__VA_ARGS__), \
+        ug::Log_Severity::severity, ug::Log_Subsystem::subsystem, \
+        __FILE__, __LINE__}; \
+      ug::log(ug_log_site_, __VA_ARGS__); \
+    } \
+  } while(0)
+
+#if UG_LOG_MIN_SEVERITY <= 0
+  #define UG_LOG_Debug_(subsystem, ...) \
+    UG_LOG_AT_(Debug, subsystem, __VA_ARGS__)
+#else
+  #define UG_LOG_Debug_(subsystem, ...) ((void) 0)
+#endif
+#if UG_LOG_MIN_SEVERITY <= 1
+  #define UG_LOG_Info_(subsystem, ...) \
+    UG_LOG_AT_(Info, subsystem, __VA_ARGS__)
 #else
-  #define UG_LOG_ATTEMPT_INIT() ((void*)0)
+  #define UG_LOG_Info_(subsystem, ...) ((void) 0)
+#endif
+#if UG_LOG_MIN_SEVERITY <= 2
+  #define UG_LOG_Warning_(subsystem, ...) \
+    UG_LOG_AT_(Warning, subsystem, __VA_ARGS__)
+#else
+  #define UG_LOG_Warning_(subsystem, ...) ((void) 0)
+#endif
+#if UG_LOG_MIN_SEVERITY <= 3
+  #define UG_LOG_Error_(subsystem, ...) \
+    UG_LOG_AT_(Error, subsystem, __VA_ARGS__)
+#else
+  #define UG_LOG_Error_(subsystem, ...) ((void) 0)
+#endif
 
-  #define UG_LOG_E ((void*)0)
-  #define UG_LOG_W ((void*)0)
-  #define UG_LOG_I ((void*)0)
-  #define UG_LOG_D ((void*)0)
+// For example: UG_LOG(Debug, Rpc, "Got request %", req.fn);
+#define UG_LOG(severity, subsystem, ...) \
+  UG_LOG_##severity##_(subsystem, __VA_ARGS__)
+
+#define UG_LOG_E(...) UG_LOG(Error, General, __VA_ARGS__)
+#define UG_LOG_W(...) UG_LOG(Warning, General, __VA_ARGS__)
+#define UG_LOG_I(...) UG_LOG(Info, General, __VA_ARGS__)
+#define UG_LOG_D(...) UG_LOG(Debug, General, __VA_ARGS__)
+
+#if UG_LOG_MIN_SEVERITY < 4
+  #define UG_LOG_ATTEMPT_INIT() ug::init_log()
+#else
+  #define UG_LOG_ATTEMPT_INIT() ((void) 0)
 #endif
 
 namespace ug
@@ -48,9 +106,21 @@ namespace ug
     Scoped_Log_Init() noexcept;
     ~Scoped_Log_Init() noexcept;
   };
+
+  /*!
+   * \brief Starts the thread that writes log messages.
+   *
+   * Logging queues messages without waiting on anything, they are dropped
+   * until the log is initialized or when the writer falls too far behind.
+   * Calls nest, the last uninit_log writes whatever is left and stops the
+   * thread.
+   */
   void init_log() noexcept;
   void uninit_log() noexcept;
+
+  // Wakes the writer up without waiting for it.
   void flush_log() noexcept;
+  // Returns once everything logged so far is written.
   void flush_log_full() noexcept;
 
   enum class Log_Severity : unsigned int
@@ -58,46 +128,214 @@ namespace ug
     Debug = 0, Info, Warning, Error
   };
 
+  // Parts of the engine whose messages can be let through separately.
+  enum class Log_Subsystem : unsigned int
+  {
+    General = 0, IO, Rpc, Render, Physics
+  };
+  constexpr std::size_t Log_Subsystem_Count = 5;
+
+  // Messages are appended to the file from now on, null goes back to
+  // stdout.
   void set_log_filename(char const* const filename) noexcept;
+
+  // Messages less severe than this are dropped right away, from any thread.
+  // Setting the out level sets it for every subsystem.
   void set_out_log_level(Log_Severity level) noexcept;
+  Log_Severity out_log_level() noexcept;
+  void set_log_level(Log_Subsystem subsystem, Log_Severity level) noexcept;
+  Log_Severity log_level(Log_Subsystem subsystem) noexcept;
+
+  // Messages dropped because the writer fell behind.
+  std::size_t dropped_log_messages() noexcept;
+
+  /*!
+   * \brief How the writer writes messages out.
+   *
+   * In binary mode the UG_LOG macros only pack their arguments with msgpack,
+   * the format is written once for each call site and nothing is formatted
+   * until the log is decoded with ug_log_decode. Other messages are stored
+   * as text. Switch before anything is logged to the file, or along with
+   * set_log_filename.
+   */
+  enum class Log_Format : unsigned int
+  {
+    Text = 0, Binary
+  };
+  void set_log_format(Log_Format format) noexcept;
+
+  namespace detail
+  {
+    extern std::atomic<Log_Severity> log_levels[Log_Subsystem_Count];
+    extern std::atomic<Log_Format> log_format;
+  }
+
+  inline Log_Format log_format() noexcept
+  {
+    return detail::log_format.load(std::memory_order_relaxed);
+  }
+
+  // Appends a message the way the text log writes it, colours and all.
+  void append_log_line(std::string& out, Log_Severity severity,
+                       std::time_t time, Format_View msg) noexcept;
+
+  // Cheap enough to check before a message is even formatted.
+  inline bool log_enabled(Log_Severity severity,
+                          Log_Subsystem subsystem) noexcept
+  {
+    auto level = detail::log_levels[(unsigned int) subsystem]
+                   .load(std::memory_order_relaxed);
+    return severity >= level;
+  }
+
+  void log(Log_Severity severity, Log_Subsystem subsystem,
+           std::string msg) noexcept;
+
+  /*!
+   * \brief Where a message is logged from.
+   *
+   * Each one gets an id when it's constructed, binary logs refer to the
+   * site by it instead of repeating the format.
+   */
+  struct Log_Site
+  {
+    Log_Site(char const* format, Log_Severity severity,
+             Log_Subsystem subsystem, char const* file,
+             unsigned int line) noexcept;
+
+    unsigned int id;
+    char const* format;
+    Log_Severity severity;
+    Log_Subsystem subsystem;
+    char const* file;
+    unsigned int line;
+  };
+
+  // Returns null for ids that were never given out.
+  Log_Site const* find_log_site(unsigned int id) noexcept;
+
+  // An argument of a binary message, as it was passed.
+  struct Log_Value
+  {
+    enum class Kind
+    {
+      Signed, Unsigned, Double, String
+    } kind;
+
+    union
+    {
+      long long i;
+      unsigned long long u;
+      double d;
+    };
+    // Strings aren't copied until they are packed.
+    char const* str;
+    std::size_t size;
+  };
+
+  inline void to_log_value(Log_Value& val, std::string const& str) noexcept
+  {
+    val.kind = Log_Value::Kind::String;
+    val.str = str.data();
+    val.size = str.size();
+  }
+  inline void to_log_value(Log_Value& val, char const* str) noexcept
+  {
+    val.kind = Log_Value::Kind::String;
+    val.str = str;
+    val.size = std::strlen(str);
+  }
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_signed<T>::value>::type
+    to_log_value(Log_Value& val, T v) noexcept
+  {
+    val.kind = Log_Value::Kind::Signed;
+    val.i = v;
+  }
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_unsigned<T>::value>::type
+    to_log_value(Log_Value& val, T v) noexcept
+  {
+    val.kind = Log_Value::Kind::Unsigned;
+    val.u = v;
+  }
+  template <class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type
+    to_log_value(Log_Value& val, T v) noexcept
+  {
+    val.kind = Log_Value::Kind::Double;
+    val.d = v;
+  }
+
+  // Packs the arguments and queues them with the site's id.
+  void log_binary(Log_Site const& site, Log_Value const* values,
+                  std::size_t count) noexcept;
+
+  template <class... Args>
+  void log(Log_Site const& site, Format_View msg, Args&&... args) noexcept
+  {
+    if(log_format() == Log_Format::Binary)
+    {
+      // One more so it's never empty.
+      Log_Value values[sizeof...(Args) + 1];
+      std::size_t i = 0;
+      int expand[] = {0, (to_log_value(values[i++], args), 0)...};
+      (void) expand;
+
+      log_binary(site, values, sizeof...(Args));
+      return;
+    }
+    log(site.severity, site.subsystem,
+        format_str(msg, std::forward<Args>(args)...));
+  }
+
+  template <class... Args>
+  void log(Log_Severity severity, Log_Subsystem subsystem, Format_View msg,
+           Args&&... args) noexcept
+  {
+    if(!log_enabled(severity, subsystem)) return;
+    log(severity, subsystem, format_str(msg, std::forward<Args>(args)...));
+  }
 
   template <class... Args>
-  void log(Log_Severity severity, std::string msg, Args&&... args) noexcept
+  void log(Log_Severity severity, Format_View msg, Args&&... args) noexcept
   {
-    log(severity, format(msg, 0, "", std::forward<Args>(args)...));
+    log(severity, Log_Subsystem::General, msg, std::forward<Args>(args)...);
   }
   void log(Log_Severity severity, std::string msg) noexcept;
 
   void log_e(std::string msg) noexcept;
 
   template <class... Args>
-  void log_e(std::string msg, Args&&... args) noexcept
+  void log_e(Format_View msg, Args&&... args) noexcept
   {
-    log_e(format(msg, 0, "", std::forward<Args>(args)...));
+    log(Log_Severity::Error, msg, std::forward<Args>(args)...);
   }
 
   void log_w(std::string msg) noexcept;
 
   template <class... Args>
-  void log_w(std::string msg, Args&&... args) noexcept
+  void log_w(Format_View msg, Args&&... args) noexcept
   {
-    log_w(format(msg, 0, "", std::forward<Args>(args)...));
+    log(Log_Severity::Warning, msg, std::forward<Args>(args)...);
   }
 
   void log_i(std::string msg) noexcept;
 
   template <class... Args>
-  void log_i(std::string msg, Args&&... args) noexcept
+  void log_i(Format_View msg, Args&&... args) noexcept
   {
-    log_i(format(msg, 0, "", std::forward<Args>(args)...));
+    log(Log_Severity::Info, msg, std::forward<Args>(args)...);
   }
 
   void log_d(std::string msg) noexcept;
 
   template <class... Args>
-  void log_d(std::string msg, Args&&... args) noexcept
+  void log_d(Format_View msg, Args&&... args) noexcept
   {
-    log_d(format(msg, 0, "", std::forward<Args>(args)...));
+    log(Log_Severity::Debug, msg, std::forward<Args>(args)...);
   }
 }
 BEGIN_FORMATTER_SCOPE
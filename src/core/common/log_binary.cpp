@@ -0,0 +1,189 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "log_binary.h"
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "log.h"
+namespace ug
+{
+  namespace
+  {
+    void to_format_args(std::vector<Format_Arg>& list,
+                        msgpack::object const& args) noexcept
+    {
+      if(args.type != msgpack::type::ARRAY) return;
+
+      list.resize(args.via.array.size);
+      for(std::size_t i = 0; i < list.size(); ++i)
+      {
+        msgpack::object const& arg = args.via.array.ptr[i];
+        switch(arg.type)
+        {
+        case msgpack::type::POSITIVE_INTEGER:
+          format_unsigned(list[i], arg.via.u64);
+          break;
+        case msgpack::type::NEGATIVE_INTEGER:
+          format_signed(list[i], arg.via.i64);
+          break;
+        case msgpack::type::FLOAT:
+          format_double(list[i], arg.via.f64);
+          break;
+        case msgpack::type::STR:
+          list[i].data = arg.via.str.ptr;
+          list[i].size = arg.via.str.size;
+          break;
+        default:
+          to_format_arg(list[i], "?");
+          break;
+        }
+      }
+    }
+  }
+
+  void format_log_args(std::string& out, Format_View msg,
+                       msgpack::object const& args) noexcept
+  {
+    std::vector<Format_Arg> list;
+    to_format_args(list, args);
+    format_into(out, msg, list.data(), list.size());
+  }
+  void format_log_args(std::string& out, Format_Template const& msg,
+                       msgpack::object const& args) noexcept
+  {
+    std::vector<Format_Arg> list;
+    to_format_args(list, args);
+    format_into(out, msg, list.data(), list.size());
+  }
+
+  namespace
+  {
+    struct Decoder
+    {
+      bool started = false;
+      // Formats by site id.
+      std::unordered_map<unsigned int, Format_Template> sites;
+      std::string line;
+    };
+
+    std::time_t to_time(msgpack::object const& ns)
+    {
+      return ns.as<long long>() / 1000000000;
+    }
+    Log_Severity to_severity(msgpack::object const& severity)
+    {
+      auto val = severity.as<unsigned int>();
+      if(val > (unsigned int) Log_Severity::Error) throw msgpack::type_error();
+      return static_cast<Log_Severity>(val);
+    }
+
+    // Throws msgpack::type_error when the record isn't what we expect.
+    bool decode_record(Decoder& d, msgpack::object const& obj,
+                       std::ostream& out)
+    {
+      if(obj.type != msgpack::type::ARRAY || !obj.via.array.size)
+      {
+        return false;
+      }
+      msgpack::object const* fields = obj.via.array.ptr;
+      std::size_t size = obj.via.array.size;
+
+      auto kind = static_cast<Log_Record_Kind>(fields[0].as<unsigned int>());
+      if(kind == Log_Record_Kind::Header)
+      {
+        if(size != 3 || fields[1].as<std::string>() != Binary_Log_Magic ||
+           fields[2].as<unsigned int>() != Binary_Log_Version)
+        {
+          return false;
+        }
+        d.started = true;
+        d.sites.clear();
+        return true;
+      }
+      // Anything before the header means this isn't ours.
+      if(!d.started) return false;
+
+      d.line.clear();
+      switch(kind)
+      {
+      case Log_Record_Kind::Site:
+        if(size != 7) return false;
+        d.sites[fields[1].as<unsigned int>()] =
+          Format_Template{fields[4].as<std::string>()};
+        return true;
+      case Log_Record_Kind::Message:
+      {
+        if(size != 5) return false;
+        Log_Severity severity = to_severity(fields[2]);
+        auto site = d.sites.find(fields[3].as<unsigned int>());
+        if(site == d.sites.end()) return false;
+
+        std::string msg;
+        format_log_args(msg, site->second, fields[4]);
+        append_log_line(d.line, severity, to_time(fields[1]), msg);
+        break;
+      }
+      case Log_Record_Kind::Text:
+      {
+        if(size != 4) return false;
+        Log_Severity severity = to_severity(fields[2]);
+        append_log_line(d.line, severity, to_time(fields[1]),
+                        fields[3].as<std::string>());
+        break;
+      }
+      default:
+        return false;
+      }
+      out.write(d.line.data(), d.line.size());
+      return true;
+    }
+  }
+
+  bool decode_binary_log(std::istream& in, std::ostream& out) noexcept
+  {
+    constexpr std::size_t Read_Size = 64 * 1024;
+
+    Decoder d;
+    msgpack::unpacker unpacker;
+    try
+    {
+      while(in)
+      {
+        unpacker.reserve_buffer(Read_Size);
+        in.read(unpacker.buffer(), Read_Size);
+        unpacker.buffer_consumed(in.gcount());
+
+        msgpack::unpacked unpacked;
+        while(unpacker.next(&unpacked))
+        {
+          if(!decode_record(d, unpacked.get(), out)) return false;
+        }
+      }
+    }
+    catch(std::exception&)
+    {
+      return false;
+    }
+    out.flush();
+    // Whatever is left is half a record.
+    return d.started && !unpacker.nonparsed_size();
+  }
+}
@@ -0,0 +1,60 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <iosfwd>
+#include <string>
+#include "format.h"
+#include "msgpack.hpp"
+namespace ug
+{
+  /*
+   * A binary log is a sequence of msgpack arrays, each starting with its
+   * kind:
+   *
+   * [Header, "ug-log", version] starts every file, or every time the log is
+   * opened again. Site ids are only good until the next header.
+   * [Site, id, severity, subsystem, format, file, line] comes before the
+   * first message from that site.
+   * [Message, ns, severity, site id, [args...]]
+   * [Text, ns, severity, text] for messages that were already formatted.
+   *
+   * Times are nanoseconds since the epoch.
+   */
+  enum class Log_Record_Kind : unsigned int
+  {
+    Header = 0, Site, Message, Text
+  };
+  constexpr char const* const Binary_Log_Magic = "ug-log";
+  constexpr unsigned int Binary_Log_Version = 1;
+
+  // Formats msg with the packed arguments of a binary message.
+  void format_log_args(std::string& out, Format_View msg,
+                       msgpack::object const& args) noexcept;
+  void format_log_args(std::string& out, Format_Template const& msg,
+                       msgpack::object const& args) noexcept;
+
+  /*!
+   * \brief Writes a binary log out as the text log would have been.
+   *
+   * Returns false if the input isn't a binary log or is cut off somewhere,
+   * everything before that is still written.
+   */
+  bool decode_binary_log(std::istream& in, std::ostream& out) noexcept;
+}
@@ -0,0 +1,150 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+namespace ug
+{
+  /*!
+   * \brief Bounded queue for any number of producer threads and one consumer
+   * thread.
+   *
+   * Producers claim a slot with a compare and swap, then publish it through
+   * the slot's sequence number, so nobody ever takes a lock or waits on a
+   * producer that was preempted halfway through.
+   */
+  template <class T>
+  struct Mpsc_Ring
+  {
+    // Rounded up to a power of two.
+    explicit Mpsc_Ring(std::size_t capacity) noexcept;
+
+    Mpsc_Ring(Mpsc_Ring const&) = delete;
+    Mpsc_Ring& operator=(Mpsc_Ring const&) = delete;
+
+    // Any thread. Leaves t alone and returns false if the ring is full.
+    bool push(T&& t) noexcept;
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& t) noexcept;
+
+    // Values pushed so far, including ones still being published.
+    inline std::size_t pushed() const noexcept;
+    // Values popped so far, consumer only.
+    inline std::size_t popped() const noexcept;
+
+    inline std::size_t capacity() const noexcept;
+  private:
+    struct Slot
+    {
+      // Equal to the position when the slot is free for it, one past it
+      // when the value at that position was published.
+      std::atomic<std::size_t> seq;
+      T value;
+    };
+
+    std::size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+
+    // Producers hammer tail_, keep it off the consumer's cache line. Padded
+    // by hand, plain operator new doesn't honour alignas before C++17.
+    char pad0_[64];
+    std::atomic<std::size_t> tail_{0};
+    char pad1_[64 - sizeof(std::atomic<std::size_t>)];
+    std::size_t head_ = 0;
+    char pad2_[64 - sizeof(std::size_t)];
+  };
+
+  template <class T>
+  Mpsc_Ring<T>::Mpsc_Ring(std::size_t capacity) noexcept
+  {
+    std::size_t size = 1;
+    while(size < capacity) size <<= 1;
+
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for(std::size_t i = 0; i < size; ++i)
+    {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  template <class T>
+  bool Mpsc_Ring<T>::push(T&& t) noexcept
+  {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true)
+    {
+      slot = &slots_[pos & mask_];
+      std::size_t seq = slot->seq.load(std::memory_order_acquire);
+      if(seq == pos)
+      {
+        if(tail_.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) break;
+      }
+      else if(seq < pos)
+      {
+        // The consumer hasn't gotten to the value a lap ago.
+        return false;
+      }
+      else
+      {
+        // Another producer got here first.
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->value = std::move(t);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <class T>
+  bool Mpsc_Ring<T>::pop(T& t) noexcept
+  {
+    Slot& slot = slots_[head_ & mask_];
+    if(slot.seq.load(std::memory_order_acquire) != head_ + 1) return false;
+
+    t = std::move(slot.value);
+    // Free for the producer one lap ahead.
+    slot.seq.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  template <class T>
+  inline std::size_t Mpsc_Ring<T>::pushed() const noexcept
+  {
+    return tail_.load(std::memory_order_acquire);
+  }
+  template <class T>
+  inline std::size_t Mpsc_Ring<T>::popped() const noexcept
+  {
+    return head_;
+  }
+
+  template <class T>
+  inline std::size_t Mpsc_Ring<T>::capacity() const noexcept
+  {
+    return mask_ + 1;
+  }
+}
@@ -0,0 +1,117 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <type_traits>
+#include <tuple>
+#include <msgpack.hpp>
+#include "helper.h"
+BEGIN_FORMATTER_SCOPE
+{
+  // Whether a type is described by its properties tuple, see
+  // DECLARE_FORMATTED_AS_OBJECT.
+  template <class Type, class Enable = void>
+  struct is_formatted_as_object : std::false_type {};
+
+  template <class Type>
+  struct is_formatted_as_object<Type,
+           typename ug::enable_if_type<typename Type::formatter_type>::type>
+    : std::is_same<detail::as_object, typename Type::formatter_type> {};
+}
+END_FORMATTER_SCOPE
+
+// Msgpack adaptors so types that can be formatted to json can also be
+// written to and read from msgpack. Objects go over the wire as an array of
+// their properties, in order, which is a lot more compact than a map. Enums
+// are just their underlying value.
+namespace msgpack { MSGPACK_API_VERSION_NAMESPACE(v1) { namespace adaptor
+{
+  template <class Type>
+  struct convert<Type, std::enable_if_t<
+                   FORMATTER_NAMESPACE::is_formatted_as_object<Type>::value> >
+  {
+    msgpack::object const& operator()(msgpack::object const& o,
+                                       Type& v) const
+    {
+      using tuple_t = typename Type::properties_tuple;
+      if(o.type != msgpack::type::ARRAY ||
+         o.via.array.size != std::tuple_size<tuple_t>::value)
+      {
+        throw msgpack::type_error();
+      }
+
+      tuple_t tup = o.as<tuple_t>();
+      v = FORMATTER_NAMESPACE::construct_from_tuple<Type, 0>(tup);
+      return o;
+    }
+  };
+
+  template <class Type>
+  struct pack<Type, std::enable_if_t<
+                FORMATTER_NAMESPACE::is_formatted_as_object<Type>::value> >
+  {
+    template <class Stream>
+    msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o,
+                                        Type const& v) const
+    {
+      return o.pack(v.properties());
+    }
+  };
+
+  template <class Type>
+  struct object_with_zone<Type, std::enable_if_t<
+                FORMATTER_NAMESPACE::is_formatted_as_object<Type>::value> >
+  {
+    void operator()(msgpack::object::with_zone& o, Type const& v) const
+    {
+      o << v.properties();
+    }
+  };
+
+  template <class Type>
+  struct convert<Type, std::enable_if_t<std::is_enum<Type>::value> >
+  {
+    msgpack::object const& operator()(msgpack::object const& o,
+                                       Type& v) const
+    {
+      v = static_cast<Type>(o.as<std::underlying_type_t<Type> >());
+      return o;
+    }
+  };
+
+  template <class Type>
+  struct pack<Type, std::enable_if_t<std::is_enum<Type>::value> >
+  {
+    template <class Stream>
+    msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o,
+                                        Type const& v) const
+    {
+      return o.pack(static_cast<std::underlying_type_t<Type> >(v));
+    }
+  };
+
+  template <class Type>
+  struct object_with_zone<Type, std::enable_if_t<std::is_enum<Type>::value> >
+  {
+    void operator()(msgpack::object::with_zone& o, Type const& v) const
+    {
+      o << static_cast<std::underlying_type_t<Type> >(v);
+    }
+  };
+} } }
@@ -0,0 +1,99 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+namespace ug
+{
+  /*!
+   * \brief Bounded queue for one producer thread and one consumer thread.
+   *
+   * Neither side ever takes a lock, values are moved in and out of slots
+   * allocated once up front.
+   */
+  template <class T>
+  struct Spsc_Ring
+  {
+    // Rounded up to a power of two.
+    explicit Spsc_Ring(std::size_t capacity) noexcept;
+
+    Spsc_Ring(Spsc_Ring const&) = delete;
+    Spsc_Ring& operator=(Spsc_Ring const&) = delete;
+
+    // Producer only. Leaves t alone and returns false if the ring is full.
+    bool push(T&& t) noexcept;
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& t) noexcept;
+
+    inline std::size_t capacity() const noexcept;
+  private:
+    std::size_t mask_;
+    std::unique_ptr<T[]> slots_;
+
+    // Each side only writes its own index, keep them off each other's cache
+    // line. Padded by hand rather than with alignas, plain operator new
+    // doesn't honour over-alignment before C++17.
+    char pad0_[64];
+    std::atomic<std::size_t> head_{0};
+    char pad1_[64 - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> tail_{0};
+    char pad2_[64 - sizeof(std::atomic<std::size_t>)];
+  };
+
+  template <class T>
+  Spsc_Ring<T>::Spsc_Ring(std::size_t capacity) noexcept
+  {
+    std::size_t size = 1;
+    while(size < capacity) size <<= 1;
+
+    mask_ = size - 1;
+    slots_.reset(new T[size]);
+  }
+
+  template <class T>
+  bool Spsc_Ring<T>::push(T&& t) noexcept
+  {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail - head_.load(std::memory_order_acquire) > mask_) return false;
+
+    slots_[tail & mask_] = std::move(t);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <class T>
+  bool Spsc_Ring<T>::pop(T& t) noexcept
+  {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_.load(std::memory_order_acquire)) return false;
+
+    t = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <class T>
+  inline std::size_t Spsc_Ring<T>::capacity() const noexcept
+  {
+    return mask_ + 1;
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "stats.h"
+#include <algorithm>
+namespace ug
+{
+  constexpr std::size_t Latency_Histogram::Bucket_Count;
+  DEFINE_PROPERTY_VALUES(Latency_Histogram);
+  DEFINE_PROPERTY_VALUES(IO_Stats);
+
+  void Latency_Histogram::record(uint64_t ns) noexcept
+  {
+    std::size_t bucket = 0;
+    while(bucket < Bucket_Count - 1 && (ns >> (bucket + 1))) ++bucket;
+
+    ++buckets[bucket];
+    ++count;
+    total_ns += ns;
+    if(ns > max_ns) max_ns = ns;
+  }
+
+  uint64_t Latency_Histogram::percentile(double p) const noexcept
+  {
+    uint64_t wanted = count * p;
+    uint64_t seen = 0;
+    for(std::size_t i = 0; i < Bucket_Count; ++i)
+    {
+      seen += buckets[i];
+      if(seen > wanted) return std::min(uint64_t(2) << i, max_ns);
+    }
+    return max_ns;
+  }
+
+  std::string describe(Latency_Histogram const& h) noexcept
+  {
+    if(!h.count) return "none";
+
+    return std::to_string(h.count) + " took " +
+           std::to_string(h.total_ns / h.count) + "ns on average, " +
+           std::to_string(h.percentile(.99)) + "ns at p99, " +
+           std::to_string(h.max_ns) + "ns at most";
+  }
+  std::string describe(IO_Stats const& stats) noexcept
+  {
+    return std::to_string(stats.reads) + " reads (" +
+           std::to_string(stats.bytes_read) + " bytes, " +
+           describe(stats.read_time) + "), " +
+           std::to_string(stats.writes) + " writes (" +
+           std::to_string(stats.bytes_written) + " bytes, " +
+           describe(stats.write_time) + ")";
+  }
+}
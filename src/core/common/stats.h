@@ -0,0 +1,120 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "pif/helper.h"
+namespace ug
+{
+  // Monotonic nanoseconds, only meaningful as a difference.
+  inline uint64_t stats_clock() noexcept
+  {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+  }
+
+  /*!
+   * \brief Counts durations in power of two buckets.
+   *
+   * Bucket i holds samples of [2^i, 2^(i+1)) nanoseconds, the last one
+   * everything longer. Recording is a handful of instructions.
+   */
+  struct Latency_Histogram
+  {
+    static constexpr std::size_t Bucket_Count = 32;
+
+    std::array<uint64_t, Bucket_Count> buckets{};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    void record(uint64_t ns) noexcept;
+
+    // Upper bound of the bucket the given fraction of samples falls under.
+    uint64_t percentile(double p) const noexcept;
+
+    DECLARE_FORMATTED_AS_OBJECT;
+    DECLARE_PROPERTY_VALUES(4, "Count", "Total", "Max", "Buckets");
+    DECLARE_PROPERTIES_TUPLE(uint64_t, uint64_t, uint64_t,
+                             std::array<uint64_t, Bucket_Count>);
+    DECLARE_PROPERTIES(count, total_ns, max_ns, buckets);
+  };
+
+  // Records the time from construction to destruction.
+  struct Scoped_Timer
+  {
+    explicit Scoped_Timer(Latency_Histogram& h) noexcept
+      : histogram_(h), start_(stats_clock()) {}
+    ~Scoped_Timer() noexcept
+    {
+      histogram_.record(stats_clock() - start_);
+    }
+
+    Scoped_Timer(Scoped_Timer const&) = delete;
+    Scoped_Timer& operator=(Scoped_Timer const&) = delete;
+  private:
+    Latency_Histogram& histogram_;
+    uint64_t start_;
+  };
+
+  struct IO_Stats
+  {
+    std::size_t reads = 0;
+    std::size_t bytes_read = 0;
+    std::size_t writes = 0;
+    std::size_t bytes_written = 0;
+
+    // How long consumers took with each read and how long each write took,
+    // not counting the time it waited in a queue.
+    Latency_Histogram read_time;
+    Latency_Histogram write_time;
+
+    inline void count_read(std::size_t size) noexcept;
+    inline void count_write(std::size_t size) noexcept;
+
+    DECLARE_FORMATTED_AS_OBJECT;
+    DECLARE_PROPERTY_VALUES(6, "Reads", "Bytes_Read", "Writes",
+                            "Bytes_Written", "Read_Time", "Write_Time");
+    DECLARE_PROPERTIES_TUPLE(std::size_t, std::size_t, std::size_t,
+                             std::size_t, Latency_Histogram,
+                             Latency_Histogram);
+    DECLARE_PROPERTIES(reads, bytes_read, writes, bytes_written, read_time,
+                       write_time);
+  };
+
+  inline void IO_Stats::count_read(std::size_t size) noexcept
+  {
+    ++reads;
+    bytes_read += size;
+  }
+  inline void IO_Stats::count_write(std::size_t size) noexcept
+  {
+    ++writes;
+    bytes_written += size;
+  }
+
+  // One line summaries, for the log.
+  std::string describe(Latency_Histogram const& h) noexcept;
+  std::string describe(IO_Stats const& stats) noexcept;
+}
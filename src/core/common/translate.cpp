@@ -18,16 +18,85 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "translate.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 namespace ug
 {
-  Lang language_;
+  namespace
+  {
+    // Keys are never removed, their ids index every table.
+    struct Key_Interner
+    {
+      std::mutex mutex;
+      std::unordered_map<std::string, std::size_t> ids;
+    };
+    Key_Interner& key_interner() noexcept
+    {
+      static Key_Interner interner;
+      return interner;
+    }
+
+    std::atomic<Lang_Table const*> language_{nullptr};
+
+    // Own the current table and the ones it replaced since the last
+    // reclaim, readers only ever see language_.
+    std::mutex tables_mutex_;
+    std::vector<std::shared_ptr<Lang_Table const> > tables_;
+  }
+
+  Lang_Key lang_key(std::string const& key) noexcept
+  {
+    Key_Interner& interner = key_interner();
+    std::lock_guard<std::mutex> lock{interner.mutex};
+    // Nodes don't move, so neither does the key.
+    auto res = interner.ids.emplace(key, interner.ids.size());
+    return Lang_Key{res.first->second, &res.first->first};
+  }
 
+  std::shared_ptr<Lang_Table const> compile_lang(Lang const& lang) noexcept
+  {
+    auto table = std::make_shared<Lang_Table>();
+    for(auto const& pair : lang.dict)
+    {
+      Lang_Key key = lang_key(pair.first);
+      if(key.id >= table->strings.size())
+      {
+        table->strings.resize(key.id + 1);
+        table->has.resize(key.id + 1);
+      }
+      table->strings[key.id] = Format_Template{pair.second};
+      table->has[key.id] = true;
+      table->ids.emplace(pair.first, key.id);
+    }
+    return table;
+  }
+
+  void set_lang(std::shared_ptr<Lang_Table const> table) noexcept
+  {
+    std::lock_guard<std::mutex> lock{tables_mutex_};
+    language_.store(table.get(), std::memory_order_release);
+    if(std::find(tables_.begin(), tables_.end(), table) == tables_.end())
+    {
+      tables_.push_back(std::move(table));
+    }
+  }
   void set_lang(Lang const& lang) noexcept
   {
-    language_ = lang;
+    set_lang(compile_lang(lang));
+  }
+  Lang_Table const* get_lang() noexcept
+  {
+    return language_.load(std::memory_order_acquire);
   }
-  Lang get_lang() noexcept
+  void reclaim_langs() noexcept
   {
-    return language_;
+    std::lock_guard<std::mutex> lock{tables_mutex_};
+    Lang_Table const* current = language_.load(std::memory_order_relaxed);
+    tables_.erase(std::remove_if(tables_.begin(), tables_.end(),
+    [current](std::shared_ptr<Lang_Table const> const& table)
+    {
+      return table.get() != current;
+    }), tables_.end());
   }
 }
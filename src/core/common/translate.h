@@ -18,88 +18,137 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <memory>
+#include <ostream>
 #include <string>
-#include <type_traits>
 #include <unordered_map>
+#include <vector>
+#include "format.h"
 #include "utility.h"
 namespace ug
 {
+  // A language as it's loaded.
   struct Lang
   {
     std::unordered_map<std::string, std::string> dict;
   };
 
-  void set_lang(Lang const& lang) noexcept;
-  Lang get_lang() noexcept;
-
-  inline std::string to_string_helper(std::string str) noexcept { return str; }
-
-  inline std::string to_string_helper(char const* const str) noexcept
-  { return str; }
-  inline std::string to_string_helper(char* str) noexcept
-  { return str; }
-
-  template <class T>
-  std::string to_string_helper(T&& v) noexcept { return std::to_string(v); }
-
-  inline std::string format(std::string s, int pos, std::string i) noexcept
+  /*!
+   * \brief A translation key, interned.
+   *
+   * Ids are handed out once for the whole program, so a key looked up once
+   * can be kept and used with any language. Keys are interned for good,
+   * get them when strings are loaded rather than for every lookup.
+   */
+  struct Lang_Key
   {
-    // If we have no more to replace just append the original string to
-    // whatever we have. This will leave extra percent signs if there are
-    // less arguments than percent signs but that's intentional.
-    return i + s.substr(pos);
-  }
+    std::size_t id;
+    // Stays valid for the whole program too.
+    std::string const* str;
+  };
+  Lang_Key lang_key(std::string const& key) noexcept;
 
-  template <class First, class... Args>
-  std::string format(std::string str, int pos, std::string i,
-                     First&& first, Args&&... args) noexcept
+  /*!
+   * \brief A language compiled for lookups, never changed once it's made.
+   *
+   * Each string is split up at its placeholders up front.
+   */
+  struct Lang_Table
   {
-    // If our position is past the end of the string, just return the
-    // intermediate string since it should have been completed. The reason
-    // we have to handle it here is because the user may provide extra
-    // arguments making the template above this one never be instantiated.
-    if(static_cast<int>(str.size()) <= pos) return format(str, pos, i);
-
-    auto c = str[pos];
-    if(c == '%')
+    // Returns null if the language doesn't have it.
+    Format_Template const* find(Lang_Key key) const noexcept
     {
-      // Append the first argument as a string instead of the percent sign.
-      i += to_string_helper(std::forward<First>(first));
-
-      // Format further without the 'first' argument since it has been
-      // used up.
-      return format(str, pos + 1, i, std::forward<Args>(args)...);
+      if(key.id >= has.size() || !has[key.id]) return nullptr;
+      return &strings[key.id];
     }
-    else
+    // Doesn't intern the key.
+    Format_Template const* find(std::string const& key) const noexcept
     {
-      // Pass in the original string, the new intermediate, and the
-      // arguments as is, since we haven't used them up yet.
-      return format(str, pos + 1, i + c,
-                    std::forward<First>(first), std::forward<Args>(args)...);
+      auto id = ids.find(key);
+      if(id == ids.end()) return nullptr;
+      return &strings[id->second];
     }
-  }
 
-  template <class... Args>
-  std::string format_str(std::string str, Args&&... args) noexcept
-  {
-    return format(str, 0, "", std::forward<Args>(args)...);
-  }
+    // Both by key id.
+    std::vector<Format_Template> strings;
+    std::vector<bool> has;
+    // The ids of the keys this language has.
+    std::unordered_map<std::string, std::size_t> ids;
+  };
+
+  std::shared_ptr<Lang_Table const> compile_lang(Lang const& lang) noexcept;
+
+  /*!
+   * \brief Swaps in the language used by translate, from any thread.
+   *
+   * The table that was in use is kept around until the next reclaim_langs,
+   * so readers that already got it from get_lang can keep going.
+   */
+  void set_lang(std::shared_ptr<Lang_Table const> table) noexcept;
+  void set_lang(Lang const& lang) noexcept;
+  /*!
+   * \brief The current language, null until one is set.
+   *
+   * Just an atomic load, nothing is counted or locked. The table stays
+   * valid until the next reclaim_langs.
+   */
+  Lang_Table const* get_lang() noexcept;
+  /*!
+   * \brief Frees the languages swapped out since the last call.
+   *
+   * Call it where no thread is holding on to a table from get_lang, like in
+   * between frames.
+   */
+  void reclaim_langs() noexcept;
 
   template <class... Args>
-  void write_format_str(std::ostream& o, std::string str,
+  void write_format_str(std::ostream& o, Format_View str,
                         Args&&... args) noexcept
   {
     o << format_str(str, std::forward<Args>(args)...);
   }
 
+  /*!
+   * \brief Formats the current language's string for the key.
+   *
+   * Keys the language doesn't have are formatted themselves, so they show
+   * up on screen instead of nothing.
+   */
   template <class... Args>
-  std::string translate(std::string str, Args&&... args) noexcept
+  std::string translate(Lang_Key key, Args&&... args) noexcept
   {
-    return format(get_lang().dict.at(str), 0, "", std::forward<Args>(args)...);
+    auto table = get_lang();
+    if(table)
+    {
+      if(Format_Template const* str = table->find(key))
+      {
+        return format(*str, std::forward<Args>(args)...);
+      }
+    }
+    return format_str(*key.str, std::forward<Args>(args)...);
+  }
+  // Looks the key up in the table itself, prefer keeping a Lang_Key.
+  template <class... Args>
+  std::string translate(std::string const& str, Args&&... args) noexcept
+  {
+    auto table = get_lang();
+    if(table)
+    {
+      if(Format_Template const* found = table->find(str))
+      {
+        return format(*found, std::forward<Args>(args)...);
+      }
+    }
+    return format_str(str, std::forward<Args>(args)...);
   }
 
   template <class... Args>
-  std::string t(std::string str, Args&&... args) noexcept
+  std::string t(Lang_Key key, Args&&... args) noexcept
+  {
+    return translate(key, std::forward<Args>(args)...);
+  }
+  template <class... Args>
+  std::string t(std::string const& str, Args&&... args) noexcept
   {
     return translate(str, std::forward<Args>(args)...);
   }
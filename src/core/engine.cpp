@@ -19,6 +19,7 @@
  */
 #include "engine.h"
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <fstream>
@@ -29,8 +30,10 @@
 #include "SDL.h"
 #include "json/json.h"
 
+#include "io/io_context.h"
+
 #include "rpc/plugins.h"
-#include "rpc/Req_Dispatcher.h"
+#include "rpc/dispatch.h"
 
 #include "common/log.h"
 
@@ -55,45 +58,97 @@ namespace engine
 
     SDL_RenderPresent(state.renderer);
   }
+
+  Plugin_Registration::Plugin_Registration(State& state,
+                                           ug::Plugin& plugin) noexcept
+    : state_(state), plugin_(&plugin)
+  {
+    state_.plugins.push_back(plugin_);
+  }
+  Plugin_Registration::~Plugin_Registration() noexcept
+  {
+    auto& plugins = state_.plugins;
+    plugins.erase(std::remove(plugins.begin(), plugins.end(), plugin_),
+                  plugins.end());
+  }
+
+  void log_stats(State const& state) noexcept
+  {
+    for(std::size_t i = 0; i < state.plugins.size(); ++i)
+    {
+      UG_LOG_I("Plugin %: %", i, ug::describe(state.plugins[i]->stats()));
+    }
+  }
+}
+
+namespace
+{
+  // How long a frame waits for plugin io when there's nothing to read yet.
+  constexpr int Frame_Ms = 16;
 }
 
 int main(int argc, char** argv)
 {
   if(argc < 2)
   {
-    std::cerr << "usage: " << argv[0] << " <plugin>" << std::endl;
+    std::cerr << "usage: " << argv[0] << " <plugin> [args...]" << std::endl;
     return EXIT_FAILURE;
   }
 
-  ug::Scoped_Log_Init log_init{};
+  ug::Scoped_Log_Init log_init;
+
+  // Every plugin is serviced by this one loop, the log writes from its own
+  // thread.
+  ug::IO_Context io_ctx;
 
   UG_LOG_I("Spawning mod: %", argv[1]);
-  //pong::Json_Plugin plugin = engine::spawn_plugin(json);
 
-  //engine::State state;
-  //pong::Req_Dispatcher dispatch;
+  // The rest of our arguments are the plugin's, argv is null terminated
+  // just like they need to be.
+  ug::ipc::Spawn_Options opt;
+  opt.args = argv + 1;
+  opt.cwd = NULL;
+
+  // Plugins are added as they are spawned, their stats are logged when we
+  // exit.
+  engine::State state;
+
+  std::unique_ptr<ug::Msgpack_Plugin> plugin;
+  try
+  {
+    plugin = std::make_unique<ug::Msgpack_Plugin>(
+      std::make_unique<ug::Child_Process>(opt, io_ctx));
+  }
+  catch(ug::ipc::Spawn_Error& e)
+  {
+    UG_LOG_E("Failed to spawn mod: % (%)", argv[1], uv_strerror(e.err));
+    return EXIT_FAILURE;
+  }
+  engine::Plugin_Registration registration{state, *plugin};
 
-  // Populate the dispatcher!
-  //engine::add_core_methods(dispatch, state, log);
+  ug::Req_Dispatcher dispatch;
+  engine::add_core_methods(dispatch, state);
 
-  //while(state.running)
+  std::vector<ug::Request> reqs;
+  while(state.running)
   {
-    //pong::Request req;
-    //while(plugin.poll_request(req))
+    // One loop run services every plugin.
+    io_ctx.step(Frame_Ms);
+
+    plugin->poll_requests(reqs);
+    for(ug::Request const& req : reqs)
     {
-      //pong::Response res = dispatch.dispatch(req);
-
-      // If the id is valid it means the requester wants a response back.
-      //if(res.id)
-      {
-        // The id we know is going to be true, so we can forget about the
-        // exception that is thrown when it isn't.
-        //plugin.post_response(res);
-      }
+      // Responses go straight into the plugin's pending output, requests
+      // without an id don't get one.
+      ug::Run_Context ctx = plugin->response_context(req);
+      dispatch.dispatch(req, &ctx);
     }
+    plugin->flush();
 
-    //engine::step(state);
+    engine::step(state);
   }
 
+  engine::log_stats(state);
+
   return 0;
 }
@@ -27,7 +27,7 @@
 #include "common/log.h"
 
 #include "rpc/plugins.h"
-#include "rpc/Req_Dispatcher.h"
+#include "rpc/dispatch.h"
 
 #include "render/widgets/Label.h"
 #include "render/color.h"
@@ -44,7 +44,30 @@ namespace engine
     bool freeze = false;
 
     ug::ID_Map<ug::Label<std::string> > labels_;
+
+    // Reported by Core.Stats, they aren't owned. Kept up to date by
+    // Plugin_Registration.
+    std::vector<ug::Plugin*> plugins;
   };
 
+  // Lists a plugin in the state for as long as it's alive.
+  struct Plugin_Registration
+  {
+    Plugin_Registration(State& state, ug::Plugin& plugin) noexcept;
+    ~Plugin_Registration() noexcept;
+
+    Plugin_Registration(Plugin_Registration const&) = delete;
+    Plugin_Registration& operator=(Plugin_Registration const&) = delete;
+  private:
+    State& state_;
+    ug::Plugin* plugin_;
+  };
+
+  void add_core_methods(ug::Req_Dispatcher& dispatch, State& state);
+  void add_widget_methods(ug::Req_Dispatcher& dispatch, State& state);
+
   void step(State& state) noexcept;
+
+  // Logs what every plugin's stats add up to, for when the engine exits.
+  void log_stats(State const& state) noexcept;
 }
@@ -32,6 +32,11 @@ namespace ug
     return std::vector<uchar>(s.begin(), s.end());
   }
 
+  void Buf_Stream::write(char const* data, std::size_t size) noexcept
+  {
+    buf.insert(buf.end(), data, data + size);
+  }
+
   namespace literals
   {
     std::vector<uchar>
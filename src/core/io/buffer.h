@@ -30,6 +30,41 @@ namespace ug
 
   std::vector<uchar> buf_from_string(const std::string& s) noexcept;
 
+  /*!
+   * \brief Bytes someone else owns, like the memory a transport just read
+   * into.
+   *
+   * Only valid as long as whatever it was passed to is running.
+   */
+  struct Buf_View
+  {
+    Buf_View() noexcept {}
+    Buf_View(uchar const* data, std::size_t size) noexcept
+      : data_(data), size_(size) {}
+    /* implicit */ Buf_View(buf_t const& buf) noexcept
+      : data_(buf.data()), size_(buf.size()) {}
+
+    uchar const* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return !size_; }
+
+    uchar const* begin() const noexcept { return data_; }
+    uchar const* end() const noexcept { return data_ + size_; }
+  private:
+    uchar const* data_ = nullptr;
+    std::size_t size_ = 0;
+  };
+
+  /*!
+   * \brief Appends to a buffer, for use as the stream of a msgpack::packer.
+   */
+  struct Buf_Stream
+  {
+    buf_t& buf;
+
+    void write(char const* data, std::size_t size) noexcept;
+  };
+
   namespace literals
   {
     std::vector<uchar>
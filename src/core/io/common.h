@@ -19,13 +19,21 @@
  */
 #pragma once
 #include <uv.h>
+#include "../common/buffer_pool.h"
 
 namespace ug
 {
-  // libuv allocator.
+  // libuv allocator. The suggested size is ignored, we hand out whole
+  // blocks of the io pool.
   inline void alloc(uv_handle_t* handle, size_t ssize, uv_buf_t* buf)
   {
-    buf->base = new char[ssize];
-    buf->len = ssize;
+    Buffer_Pool& pool = io_buffer_pool();
+    buf->base = pool.acquire(pool.block_size());
+    buf->len = pool.block_size();
+  }
+  // Gives a buffer from alloc back to the pool, for read callbacks.
+  inline void free_buf(uv_buf_t const* buf)
+  {
+    io_buffer_pool().release(buf->base, buf->len);
   }
 }
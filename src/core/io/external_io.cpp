@@ -18,6 +18,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "external_io.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
 #include "common.h"
 #include "../common/utility.h"
 namespace ug
@@ -27,21 +30,52 @@ namespace ug
     External_IO* io = (External_IO*) p->user_data;
     io->post(*p->buf);
   }
+  void post_pipe_chunk(ipc::Pipe* p) noexcept
+  {
+    External_IO* io = (External_IO*) p->user_data;
+    io->post(p->chunk);
+  }
+  uchar* pipe_read_dest(ipc::Pipe* p, std::size_t size) noexcept
+  {
+    External_IO* io = (External_IO*) p->user_data;
+    return io->read_dest(size);
+  }
   void post_error_from_buffer(ipc::Pipe* p) noexcept
   {
     External_IO* io = (External_IO*) p->user_data;
     io->post_error(*p->buf);
   }
 
-  Child_Process::Child_Process(ipc::Spawn_Options& opt)
-  {
-    uv_loop_init(&loop_);
-
-    process_ = ipc::create_process(&loop_, opt);
+  Child_Process::Child_Process(ipc::Spawn_Options& opt, ipc::Framing framing)
+    : Child_Process(opt, make_maybe_owned<IO_Context>(), framing) {}
+  Child_Process::Child_Process(ipc::Spawn_Options& opt, IO_Context& ctx,
+                               ipc::Framing framing)
+    : Child_Process(opt, Maybe_Owned<IO_Context>{&ctx, false}, framing) {}
 
+  Child_Process::Child_Process(ipc::Spawn_Options& opt,
+                               Maybe_Owned<IO_Context> ctx,
+                               ipc::Framing framing)
+    : Child_Process(ipc::create_process(ctx->loop(), opt), std::move(ctx),
+                    framing) {}
+  Child_Process::Child_Process(ipc::Process* process,
+                               Maybe_Owned<IO_Context> ctx,
+                               ipc::Framing framing) noexcept
+    : ctx_(std::move(ctx)), process_(process)
+  {
     process_->io.in.user_data = this;
-    process_->io.in.action_cb = post_pipe_buffer;
-    uv_read_start((uv_stream_t*) &process_->io.in, alloc, ipc::collect_lines);
+    if(framing == ipc::Framing::Raw)
+    {
+      process_->io.in.action_cb = post_pipe_chunk;
+      process_->io.in.dest_cb = pipe_read_dest;
+      uv_read_start((uv_stream_t*) &process_->io.in, ipc::alloc_raw,
+                    ipc::collect_raw);
+    }
+    else
+    {
+      process_->io.in.action_cb = post_pipe_buffer;
+      uv_read_start((uv_stream_t*) &process_->io.in, alloc,
+                    ipc::collect_lines);
+    }
 
     process_->err.user_data = this;
     process_->err.action_cb = post_error_from_buffer;
@@ -53,59 +87,399 @@ namespace ug
   }
   Child_Process::~Child_Process() noexcept
   {
+    // If we own the context, it finishes closing the process when it goes.
     ipc::delete_process(process_);
-
-    uv_run(&loop_, UV_RUN_DEFAULT);
-    uv_loop_close(&loop_);
   }
   void Child_Process::write(buf_t const& buf) noexcept
   {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
     step();
     if(!process_->running) return;
-    *process_->io.out.buf = buf;
-    ipc::write_buffer(&process_->io.out);
+    ipc::write_buffer(&process_->io.out, buf.data(), buf.size());
   }
   void Child_Process::step() noexcept
   {
-    uv_run(&loop_, UV_RUN_NOWAIT);
+    if(ctx_.is_owned()) ctx_->step();
   }
 
   void post_net_buffer(net::Pipe* pipe)
   {
     Net_IO* io = (Net_IO*) pipe->user_data;
-    io->post(*pipe->out.buf);
+    io->post(pipe->chunk);
   }
 
   Net_IO::Net_IO(std::string const& bind_ip,
                  uint16_t const bind_port,
                  std::string const& write_ip,
                  uint16_t const write_port) noexcept
+    : Net_IO(bind_ip, bind_port, write_ip, write_port,
+             make_maybe_owned<IO_Context>()) {}
+  Net_IO::Net_IO(std::string const& bind_ip,
+                 uint16_t const bind_port,
+                 std::string const& write_ip,
+                 uint16_t const write_port,
+                 IO_Context& ctx) noexcept
+    : Net_IO(bind_ip, bind_port, write_ip, write_port,
+             Maybe_Owned<IO_Context>{&ctx, false}) {}
+
+  Net_IO::Net_IO(std::string const& bind_ip,
+                 uint16_t const bind_port,
+                 std::string const& write_ip,
+                 uint16_t const write_port,
+                 Maybe_Owned<IO_Context> ctx) noexcept
+    : ctx_(std::move(ctx))
   {
-    // Initialize the loop
-    uv_loop_init(&loop_);
     // Initialize the network pipe.
-    net::init_pipe(pipe_, &loop_, bind_ip, bind_port);
-    pipe_.read_cb = post_net_buffer;
+    pipe_ = net::create_pipe(ctx_->loop(), bind_ip, bind_port);
+    pipe_->user_data = this;
+    pipe_->read_cb = post_net_buffer;
 
     // Initialize the address that will be written to.
     uv_ip4_addr(write_ip.c_str(), write_port, &write_addr_);
   }
   Net_IO::~Net_IO() noexcept
   {
-    // Uninitialize the net pipe
-    net::uninit_pipe(pipe_);
-    // Uninit the loop
-    uv_loop_close(&loop_);
+    // If we own the context, it finishes closing the pipe when it goes.
+    net::delete_pipe(pipe_);
   }
 
   void Net_IO::write(buf_t const& buf) noexcept
   {
-    *pipe_.out.buf = buf;
-    net::write_buffer(pipe_, (struct sockaddr*) &write_addr_);
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    // Every datagram gets its own buffer if it has to wait, so writing again
+    // before the last one is out is fine.
+    net::send(*pipe_, buf.data(), buf.size(),
+              (struct sockaddr*) &write_addr_);
   }
   void Net_IO::step() noexcept
   {
-    uv_run(&loop_, UV_RUN_NOWAIT);
+    if(ctx_.is_owned()) ctx_->step();
+  }
+
+  void post_stream_buffer(net::Stream* stream)
+  {
+    Stream_IO* io = (Stream_IO*) stream->user_data;
+    io->post(stream->chunk);
+  }
+  uchar* stream_read_dest(net::Stream* stream, std::size_t size) noexcept
+  {
+    Stream_IO* io = (Stream_IO*) stream->user_data;
+    return io->read_dest(size);
+  }
+
+  Stream_IO::Stream_IO(net::Endpoint const& endpoint)
+    : Stream_IO(endpoint, make_maybe_owned<IO_Context>()) {}
+  Stream_IO::Stream_IO(net::Endpoint const& endpoint, IO_Context& ctx)
+    : Stream_IO(endpoint, Maybe_Owned<IO_Context>{&ctx, false}) {}
+
+  Stream_IO::Stream_IO(int fd, IO_Context& ctx)
+    : Stream_IO(net::open_stream(ctx.loop(), fd),
+                Maybe_Owned<IO_Context>{&ctx, false}) {}
+
+  Stream_IO::Stream_IO(net::Endpoint const& endpoint,
+                       Maybe_Owned<IO_Context> ctx)
+    : Stream_IO(net::connect_stream(ctx->loop(), endpoint), std::move(ctx)) {}
+  Stream_IO::Stream_IO(net::Stream* stream,
+                       Maybe_Owned<IO_Context> ctx) noexcept
+    : ctx_(std::move(ctx)), stream_(stream)
+  {
+    stream_->user_data = this;
+    stream_->read_cb = post_stream_buffer;
+    stream_->dest_cb = stream_read_dest;
+  }
+  Stream_IO::~Stream_IO() noexcept
+  {
+    // If we own the context, it finishes closing the stream when it goes.
+    net::delete_stream(stream_);
+  }
+
+  bool Stream_IO::open() const noexcept
+  {
+    return stream_->open;
+  }
+  void Stream_IO::write(buf_t const& buf) noexcept
+  {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    net::write_stream(*stream_, buf.data(), buf.size());
+  }
+  void Stream_IO::step() noexcept
+  {
+    if(ctx_.is_owned()) ctx_->step();
+  }
+
+  // Reads from pipes are single reads of this much.
+  constexpr std::size_t Uring_Read_Size = 16 * 1024;
+
+  uring::Ring* need_ring(IO_Context& ctx, int fd)
+  {
+    uring::Ring* ring = ctx.uring();
+    if(!ring)
+    {
+      // The fd is ours already, nobody else is going to close it.
+      close(fd);
+      throw uring::Setup_Error{ENOSYS};
+    }
+    return ring;
+  }
+
+  Uring_IO::Uring_IO(int fd)
+    : Uring_IO(fd, make_maybe_owned<IO_Context>()) {}
+  Uring_IO::Uring_IO(int fd, IO_Context& ctx)
+    : Uring_IO(fd, Maybe_Owned<IO_Context>{&ctx, false}) {}
+
+  Uring_IO::Uring_IO(int fd, Maybe_Owned<IO_Context> ctx)
+    : ctx_(std::move(ctx)), ring_(need_ring(*ctx_, fd)), fd_(fd)
+  {
+    struct stat st;
+    multishot_ = uring::has_multishot(*ring_) && fstat(fd_, &st) == 0 &&
+                 S_ISSOCK(st.st_mode);
+
+    read_op_ = uring::create_op(this, on_read_);
+    write_op_ = uring::create_op(this, on_write_);
+    read_();
+  }
+  Uring_IO::~Uring_IO() noexcept
+  {
+    // The ring lets go of whatever is still in flight.
+    uring::release_op(*ring_, read_op_);
+    uring::release_op(*ring_, write_op_);
+    close(fd_);
+  }
+
+  bool Uring_IO::open() const noexcept
+  {
+    return open_;
+  }
+  void Uring_IO::write(buf_t const& buf) noexcept
+  {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    if(!open_ || buf.empty()) return;
+
+    pending_.insert(pending_.end(), buf.begin(), buf.end());
+    if(!write_op_->in_flight) write_pending_();
+  }
+  void Uring_IO::step() noexcept
+  {
+    if(ctx_.is_owned()) ctx_->step();
+  }
+
+  void Uring_IO::write_pending_() noexcept
+  {
+    if(pending_.empty()) return;
+
+    // Otherwise it's tried again with the next write.
+    if(uring::write(*ring_, *write_op_, fd_, std::move(pending_)))
+    {
+      pending_.clear();
+    }
+  }
+  void Uring_IO::read_() noexcept
+  {
+    if(!open_) return;
+
+    if(multishot_ && uring::recv_multishot(*ring_, *read_op_, fd_)) return;
+    uring::read(*ring_, *read_op_, fd_, Uring_Read_Size);
+  }
+
+  void Uring_IO::on_write_(uring::Op* op, int res, Buf_View) noexcept
+  {
+    Uring_IO* self = (Uring_IO*) op->user_data;
+    if(res < 0)
+    {
+      self->open_ = false;
+      return;
+    }
+    self->write_pending_();
+  }
+  void Uring_IO::on_read_(uring::Op* op, int res, Buf_View read) noexcept
+  {
+    Uring_IO* self = (Uring_IO*) op->user_data;
+    if(res > 0)
+    {
+      self->post(read);
+    }
+    else if(res == -EINVAL && self->multishot_)
+    {
+      // The kernel doesn't do multishot receives, read normally instead.
+      self->multishot_ = false;
+    }
+    else if(res != -ENOBUFS)
+    {
+      // Hung up or broken.
+      self->open_ = false;
+      return;
+    }
+
+    // Multishot receives stop when they run out of buffers.
+    if(!op->in_flight) self->read_();
+  }
+
+  std::unique_ptr<External_IO> make_fd_io(int fd, IO_Context& ctx)
+  {
+    if(ctx.uring()) return std::make_unique<Uring_IO>(fd, ctx);
+    return std::make_unique<Stream_IO>(fd, ctx);
+  }
+
+  Stream_Listener::Stream_Listener(net::Endpoint const& endpoint,
+                                   IO_Context& ctx, accept_cb cb)
+    : ctx_(ctx), accept_cb_(cb)
+  {
+    listener_ = net::create_listener(ctx_.loop(), endpoint);
+    listener_->user_data = this;
+    listener_->connection_cb = on_connection_;
+  }
+  Stream_Listener::~Stream_Listener() noexcept
+  {
+    net::delete_listener(listener_);
+  }
+
+  uint16_t Stream_Listener::port() const noexcept
+  {
+    return net::listener_port(*listener_);
+  }
+
+  void Stream_Listener::on_connection_(net::Listener* listener) noexcept
+  {
+    Stream_Listener* self = (Stream_Listener*) listener->user_data;
+
+    net::Stream* stream = net::accept_stream(*listener);
+    if(!stream) return;
+
+    std::unique_ptr<Stream_IO> io{
+      new Stream_IO{stream, Maybe_Owned<IO_Context>{&self->ctx_, false}}};
+    self->accept_cb_(std::move(io));
+  }
+
+  constexpr std::size_t Shm_IO::Default_Capacity;
+
+  Shm_IO::Shm_IO(std::size_t capacity)
+    : channel_(shm::create_channel(capacity)) {}
+  Shm_IO::Shm_IO(std::size_t capacity, IO_Context& ctx)
+    : channel_(shm::create_channel(capacity))
+  {
+    register_(ctx);
+  }
+  Shm_IO::Shm_IO(shm::Channel_Fds const& fds)
+    : channel_(shm::open_channel(fds)) {}
+  Shm_IO::Shm_IO(shm::Channel_Fds const& fds, IO_Context& ctx)
+    : channel_(shm::open_channel(fds))
+  {
+    register_(ctx);
+  }
+  Shm_IO::~Shm_IO() noexcept
+  {
+    if(poll_)
+    {
+      uv_poll_stop(poll_);
+      uv_close((uv_handle_t*) poll_, [](uv_handle_t* h)
+      {
+        delete (uv_poll_t*) h;
+      });
+    }
+    shm::delete_channel(channel_);
+  }
+
+  bool Shm_IO::check_broken_() noexcept
+  {
+    if(!channel_->broken) return false;
+
+    // Whatever the other side does from now on, we don't look.
+    if(poll_) uv_poll_stop(poll_);
+    pending_.clear();
+    pending_.shrink_to_fit();
+    return true;
+  }
+
+  void Shm_IO::register_(IO_Context& ctx) noexcept
+  {
+    // The other side signals us whenever we may have missed something, so
+    // that's all the loop needs to watch.
+    poll_ = new uv_poll_t;
+    poll_->data = this;
+    uv_poll_init(ctx.loop(), poll_, channel_->wait_fd);
+    uv_poll_start(poll_, UV_READABLE, on_wake_);
+  }
+  void Shm_IO::on_wake_(uv_poll_t* poll, int, int) noexcept
+  {
+    ((Shm_IO*) poll->data)->service_();
+  }
+
+  shm::Channel_Fds const& Shm_IO::fds() const noexcept
+  {
+    return channel_->fds;
+  }
+  bool Shm_IO::open() const noexcept
+  {
+    return !channel_->broken;
+  }
+  std::size_t Shm_IO::pending() const noexcept
+  {
+    return pending_.size();
+  }
+
+  bool Shm_IO::wait(int timeout) noexcept
+  {
+    // If this doesn't get anything out, the other side will wake us up once
+    // it makes room.
+    auto pending = pending_.size();
+    write_pending_();
+    if(check_broken_()) return false;
+    if(pending_.size() < pending) return true;
+    return shm::wait(*channel_, timeout);
+  }
+
+  void Shm_IO::write(buf_t const& buf) noexcept
+  {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    if(channel_->broken) return;
+
+    // Keep the order of writes.
+    if(!pending_.empty())
+    {
+      pending_.insert(pending_.end(), buf.begin(), buf.end());
+      write_pending_();
+      check_broken_();
+      return;
+    }
+
+    auto written = shm::write(*channel_, buf.data(), buf.size());
+    if(check_broken_()) return;
+    pending_.insert(pending_.end(), buf.begin() + written, buf.end());
+  }
+  void Shm_IO::write_pending_() noexcept
+  {
+    if(pending_.empty()) return;
+    auto written = shm::write(*channel_, pending_.data(), pending_.size());
+    pending_.erase(pending_.begin(), pending_.begin() + written);
+  }
+  void Shm_IO::step() noexcept
+  {
+    if(!poll_) service_();
+  }
+  void Shm_IO::service_() noexcept
+  {
+    if(channel_->broken) return;
+
+    // Clear wake ups first so that one coming in while we are busy isn't
+    // lost.
+    if(poll_) shm::clear_wake_ups(*channel_);
+
+    write_pending_();
+
+    read_buf_.clear();
+    shm::read(*channel_, read_buf_);
+    if(check_broken_()) return;
+    if(read_buf_.size()) post(read_buf_);
   }
 
   Pipe_IO::Pipe_IO() noexcept
@@ -121,6 +495,9 @@ namespace ug
 
   void Pipe_IO::write(buf_t const& buf) noexcept
   {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
     // Write to the counterpart's input.
     counterpart().input_.push(buf);
   }
@@ -144,4 +521,52 @@ namespace ug
       counterpart().step_(false);
     }
   }
+
+  constexpr std::size_t Thread_Pipe_IO::Default_Capacity;
+
+  Thread_Pipe_IO::Thread_Pipe_IO(std::size_t capacity) noexcept
+    : cp_(make_owned_maybe(new Thread_Pipe_IO(*this, capacity))),
+      input_(capacity) {}
+
+  Thread_Pipe_IO::Thread_Pipe_IO(Thread_Pipe_IO& io,
+                                 std::size_t capacity) noexcept
+    : cp_(&io, false), input_(capacity) {}
+
+  Thread_Pipe_IO& Thread_Pipe_IO::counterpart() noexcept
+  {
+    return *cp_;
+  }
+
+  void Thread_Pipe_IO::write(buf_t const& buf) noexcept
+  {
+    write(buf_t(buf));
+  }
+  void Thread_Pipe_IO::write(buf_t&& buf) noexcept
+  {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    // Keep everything in order behind what's already waiting.
+    write_backlog_();
+    if(!backlog_.empty() || !counterpart().input_.push(std::move(buf)))
+    {
+      backlog_.push(std::move(buf));
+    }
+  }
+  void Thread_Pipe_IO::step() noexcept
+  {
+    write_backlog_();
+
+    buf_t buf;
+    while(input_.pop(buf)) post(buf);
+  }
+
+  void Thread_Pipe_IO::write_backlog_() noexcept
+  {
+    while(!backlog_.empty() &&
+          counterpart().input_.push(std::move(backlog_.front())))
+    {
+      backlog_.pop();
+    }
+  }
 }
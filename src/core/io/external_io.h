@@ -21,10 +21,16 @@
 #include <uv.h>
 #include <string>
 #include <functional>
+#include <memory>
 #include <queue>
 #include "../common/maybe_owned.hpp"
+#include "../common/spsc_ring.hpp"
+#include "../common/stats.h"
+#include "io_context.h"
 #include "ipc.h"
 #include "net.h"
+#include "shm.h"
+#include "uring.h"
 namespace ug
 {
   /*!
@@ -33,20 +39,52 @@ namespace ug
   struct External_IO
   {
     using read_cb = std::function<void (buf_t const&)>;
+    // Gets data wherever the transport read it, without copying it first.
+    using view_cb = std::function<void (Buf_View)>;
+    // Returns where the next read of at most size bytes should go.
+    using dest_cb = std::function<uchar* (std::size_t size)>;
 
     External_IO(read_cb r_cb = nullptr, read_cb e_cb = nullptr) noexcept
                 : read_cb_(r_cb), err_cb_(e_cb) {}
+    virtual ~External_IO() noexcept {}
 
     inline void set_read_callback(read_cb cb) noexcept;
     inline void set_error_callback(read_cb cb) noexcept;
+
+    // Used instead of the read callback when it's set.
+    inline void set_view_callback(view_cb cb) noexcept;
+
+    /*!
+     * \brief Lets the consumer say where data is read to.
+     *
+     * Transports that read chunks of a stream read them straight into the
+     * consumer's memory, then post a view of it. Others ignore this.
+     */
+    inline void set_dest_callback(dest_cb cb) noexcept;
+
     inline void post(buf_t const& buf) noexcept;
+    inline void post(Buf_View buf) noexcept;
     inline void post_error(buf_t const& err) noexcept;
 
+    // Null when the consumer doesn't care where data goes.
+    inline uchar* read_dest(std::size_t size) noexcept;
+    inline bool has_read_dest() const noexcept;
+
     virtual void write(buf_t const& buf) noexcept = 0;
     virtual void step() noexcept = 0;
+
+    inline IO_Stats const& io_stats() const noexcept;
+  protected:
+    // Reads are counted by post, implementations count their own writes.
+    IO_Stats io_stats_;
   private:
     read_cb read_cb_;
     read_cb err_cb_;
+    view_cb view_cb_;
+    dest_cb dest_cb_;
+
+    // Views are copied here for consumers that only take buffers.
+    buf_t view_buf_;
   };
 
   inline void External_IO::set_read_callback(read_cb cb) noexcept
@@ -57,39 +95,261 @@ namespace ug
   {
     err_cb_ = cb;
   }
+  inline void External_IO::set_view_callback(view_cb cb) noexcept
+  {
+    view_cb_ = cb;
+  }
+  inline void External_IO::set_dest_callback(dest_cb cb) noexcept
+  {
+    dest_cb_ = cb;
+  }
   inline void External_IO::post(buf_t const& buf) noexcept
   {
-    read_cb_(buf);
+    io_stats_.count_read(buf.size());
+    Scoped_Timer timer{io_stats_.read_time};
+
+    if(view_cb_) view_cb_(buf);
+    else read_cb_(buf);
+  }
+  inline void External_IO::post(Buf_View buf) noexcept
+  {
+    io_stats_.count_read(buf.size());
+    Scoped_Timer timer{io_stats_.read_time};
+
+    if(view_cb_)
+    {
+      view_cb_(buf);
+      return;
+    }
+    view_buf_.assign(buf.begin(), buf.end());
+    read_cb_(view_buf_);
   }
   inline void External_IO::post_error(buf_t const& buf) noexcept
   {
     err_cb_(buf);
   }
+  inline uchar* External_IO::read_dest(std::size_t size) noexcept
+  {
+    return dest_cb_ ? dest_cb_(size) : nullptr;
+  }
+  inline bool External_IO::has_read_dest() const noexcept
+  {
+    return static_cast<bool>(dest_cb_);
+  }
+  inline IO_Stats const& External_IO::io_stats() const noexcept
+  {
+    return io_stats_;
+  }
+
+  // Io objects below either run their own loop in step() or register with an
+  // IO_Context, in which case step() does nothing and the context's owner
+  // steps all of them at once.
 
   struct Child_Process : public External_IO
   {
-    Child_Process(ipc::Spawn_Options&);
+    // Framing only applies to the child's stdout, stderr is always posted
+    // one line at a time.
+    Child_Process(ipc::Spawn_Options&,
+                  ipc::Framing framing = ipc::Framing::Raw);
+    Child_Process(ipc::Spawn_Options&, IO_Context& ctx,
+                  ipc::Framing framing = ipc::Framing::Raw);
     ~Child_Process() noexcept;
 
     void write(buf_t const& buf) noexcept override;
     void step() noexcept override;
   private:
+    friend struct Process_Pool;
+    Child_Process(ipc::Spawn_Options&, Maybe_Owned<IO_Context> ctx,
+                  ipc::Framing framing);
+    // Takes over a process that was already spawned.
+    Child_Process(ipc::Process* process, Maybe_Owned<IO_Context> ctx,
+                  ipc::Framing framing) noexcept;
+
+    Maybe_Owned<IO_Context> ctx_;
     ipc::Process* process_;
-    uv_loop_t loop_;
   };
 
   struct Net_IO : public External_IO
   {
     Net_IO(std::string const& bind_ip, uint16_t const bind_port,
            std::string const& write_ip, uint16_t const write_port) noexcept;
+    Net_IO(std::string const& bind_ip, uint16_t const bind_port,
+           std::string const& write_ip, uint16_t const write_port,
+           IO_Context& ctx) noexcept;
     ~Net_IO() noexcept;
 
     void write(buf_t const& buf) noexcept override;
     void step() noexcept override;
   private:
+    Net_IO(std::string const& bind_ip, uint16_t const bind_port,
+           std::string const& write_ip, uint16_t const write_port,
+           Maybe_Owned<IO_Context> ctx) noexcept;
+
+    Maybe_Owned<IO_Context> ctx_;
     struct sockaddr_in write_addr_;
-    net::Pipe pipe_;
-    uv_loop_t loop_;
+    net::Pipe* pipe_;
+  };
+
+  /*!
+   * \brief Talks to a plugin over a Unix or TCP socket.
+   *
+   * Chunks are posted as they are read, like Child_Process with raw framing.
+   */
+  struct Stream_IO : public External_IO
+  {
+    // Connects to a listening plugin.
+    explicit Stream_IO(net::Endpoint const& endpoint);
+    Stream_IO(net::Endpoint const& endpoint, IO_Context& ctx);
+    // Takes over a connected socket or a pipe.
+    Stream_IO(int fd, IO_Context& ctx);
+    ~Stream_IO() noexcept;
+
+    // False once the peer hangs up or the connection failed.
+    bool open() const noexcept;
+
+    void write(buf_t const& buf) noexcept override;
+    void step() noexcept override;
+  private:
+    friend struct Stream_Listener;
+    Stream_IO(net::Endpoint const& endpoint, Maybe_Owned<IO_Context> ctx);
+    // Takes ownership of an open stream.
+    Stream_IO(net::Stream* stream, Maybe_Owned<IO_Context> ctx) noexcept;
+
+    Maybe_Owned<IO_Context> ctx_;
+    net::Stream* stream_;
+  };
+
+  /*!
+   * \brief Like Stream_IO but through the context's io_uring, on Linux.
+   *
+   * Every Uring_IO on a context shares its ring, so whatever all of them
+   * wrote during a loop iteration goes out in a single syscall. Small writes
+   * are copied to registered buffers and sockets are read with a multishot
+   * receive that stays armed, so a busy plugin costs no syscalls per frame.
+   *
+   * Only one write is in flight at a time, later ones are sent together
+   * once it completes.
+   */
+  struct Uring_IO : public External_IO
+  {
+    // Takes over a connected socket or a pipe.
+    // \throws uring::Setup_Error when the context has no ring, fd is closed
+    // then too.
+    explicit Uring_IO(int fd);
+    Uring_IO(int fd, IO_Context& ctx);
+    ~Uring_IO() noexcept;
+
+    // False once the peer hangs up or something failed.
+    bool open() const noexcept;
+
+    void write(buf_t const& buf) noexcept override;
+    void step() noexcept override;
+  private:
+    Uring_IO(int fd, Maybe_Owned<IO_Context> ctx);
+
+    void write_pending_() noexcept;
+    void read_() noexcept;
+    static void on_write_(uring::Op* op, int res, Buf_View) noexcept;
+    static void on_read_(uring::Op* op, int res, Buf_View read) noexcept;
+
+    Maybe_Owned<IO_Context> ctx_;
+    uring::Ring* ring_;
+    int fd_;
+    bool open_ = true;
+    // Sockets are read with a multishot receive while the ring allows it.
+    bool multishot_;
+
+    uring::Op* read_op_;
+    uring::Op* write_op_;
+    // Written while a write was in flight.
+    buf_t pending_;
+  };
+
+  /*!
+   * \brief Picks Uring_IO for the fd when the context has a ring, Stream_IO
+   * otherwise.
+   */
+  std::unique_ptr<External_IO> make_fd_io(int fd, IO_Context& ctx);
+
+  /*!
+   * \brief Accepts plugins connecting to us.
+   *
+   * Every connection is serviced by the listener's context, so one loop can
+   * take care of any number of plugins.
+   */
+  struct Stream_Listener
+  {
+    using accept_cb = std::function<void (std::unique_ptr<Stream_IO>)>;
+
+    // \throws net::Bind_Error
+    Stream_Listener(net::Endpoint const& endpoint, IO_Context& ctx,
+                    accept_cb cb);
+    ~Stream_Listener() noexcept;
+
+    Stream_Listener(Stream_Listener const&) = delete;
+    Stream_Listener& operator=(Stream_Listener const&) = delete;
+
+    // The port actually bound, for TCP.
+    uint16_t port() const noexcept;
+  private:
+    static void on_connection_(net::Listener* listener) noexcept;
+
+    IO_Context& ctx_;
+    accept_cb accept_cb_;
+    net::Listener* listener_;
+  };
+
+  /*!
+   * \brief Talks to another process on the same machine through shared
+   * memory.
+   *
+   * Writes are copied straight into a ring the other process reads from, no
+   * syscall is made unless the other side may be asleep.
+   */
+  struct Shm_IO : public External_IO
+  {
+    static constexpr std::size_t Default_Capacity = 1024 * 1024;
+
+    // Host mode. Creates the channel, give fds() to the other process.
+    explicit Shm_IO(std::size_t capacity = Default_Capacity);
+    Shm_IO(std::size_t capacity, IO_Context& ctx);
+    // Plugin mode. Attaches to a channel created by the host.
+    explicit Shm_IO(shm::Channel_Fds const& fds);
+    Shm_IO(shm::Channel_Fds const& fds, IO_Context& ctx);
+    ~Shm_IO() noexcept;
+
+    shm::Channel_Fds const& fds() const noexcept;
+
+    // False once the other side broke the channel, it isn't used after that.
+    bool open() const noexcept;
+
+    // Bytes written that are still waiting for room in the ring.
+    std::size_t pending() const noexcept;
+
+    // Blocks until there's something to read or room for pending writes.
+    bool wait(int timeout) noexcept;
+
+    // Data that doesn't fit in the ring is kept until the next step.
+    void write(buf_t const& buf) noexcept override;
+
+    // Sends pending data and posts whatever the other side wrote.
+    void step() noexcept override;
+  private:
+    void write_pending_() noexcept;
+    void register_(IO_Context& ctx) noexcept;
+    void service_() noexcept;
+    // Stops watching a broken channel, returns true if it is.
+    bool check_broken_() noexcept;
+    static void on_wake_(uv_poll_t* poll, int status, int events) noexcept;
+
+    shm::Channel* channel_;
+    // Watches for wake ups when registered with a context.
+    uv_poll_t* poll_ = nullptr;
+
+    // Written data that didn't fit in the ring yet.
+    buf_t pending_;
+    // Reused for every read.
+    buf_t read_buf_;
   };
 
   struct Pipe_IO : public External_IO
@@ -119,4 +379,40 @@ namespace ug
 
     std::queue<buf_t> input_;
   };
+
+  /*!
+   * \brief Like Pipe_IO, but each end can be used from its own thread.
+   *
+   * Buffers are moved through a lock-free ring to the other end. Each end
+   * only posts what it was sent when it's stepped, by its own thread.
+   */
+  struct Thread_Pipe_IO : public External_IO
+  {
+    static constexpr std::size_t Default_Capacity = 1024;
+
+    // The counterpart is owned, so it must be done with before this goes.
+    explicit Thread_Pipe_IO(std::size_t capacity = Default_Capacity) noexcept;
+
+    Thread_Pipe_IO& counterpart() noexcept;
+
+    // Buffers that don't fit in the counterpart's ring are kept until the
+    // next write or step, nobody waits on anybody.
+    void write(buf_t const& buf) noexcept override;
+    void write(buf_t&& buf) noexcept;
+
+    // Posts what the counterpart sent, it doesn't step the counterpart.
+    void step() noexcept override;
+  private:
+    Thread_Pipe_IO(Thread_Pipe_IO& cp, std::size_t capacity) noexcept;
+
+    void write_backlog_() noexcept;
+
+    Maybe_Owned<Thread_Pipe_IO> cp_;
+
+    // Written to by the counterpart.
+    Spsc_Ring<buf_t> input_;
+
+    // Our writes waiting for room in the counterpart's ring.
+    std::queue<buf_t> backlog_;
+  };
 }
@@ -0,0 +1,76 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "io_context.h"
+#include "uring.h"
+namespace ug
+{
+  IO_Context::IO_Context() noexcept
+  {
+    uv_loop_init(&loop_);
+
+    // The timer is only there to bound the wait, it shouldn't keep the loop
+    // alive by itself.
+    uv_timer_init(&loop_, &timeout_timer_);
+    uv_unref((uv_handle_t*) &timeout_timer_);
+  }
+  IO_Context::~IO_Context() noexcept
+  {
+    if(uring_) uring::delete_ring(uring_);
+    uv_close((uv_handle_t*) &timeout_timer_, NULL);
+
+    // Finish closing whatever is left.
+    uv_run(&loop_, UV_RUN_DEFAULT);
+    uv_loop_close(&loop_);
+  }
+
+  void IO_Context::step(int timeout) noexcept
+  {
+    if(timeout == 0)
+    {
+      uv_run(&loop_, UV_RUN_NOWAIT);
+      return;
+    }
+
+    // Waking up is enough, the timer doesn't need to do anything.
+    if(timeout > 0)
+    {
+      uv_timer_start(&timeout_timer_, [](uv_timer_t*) {}, timeout, 0);
+    }
+    uv_run(&loop_, UV_RUN_ONCE);
+    uv_timer_stop(&timeout_timer_);
+  }
+
+  uv_loop_t* IO_Context::loop() noexcept
+  {
+    return &loop_;
+  }
+  uring::Ring* IO_Context::uring() noexcept
+  {
+    if(uring_tried_) return uring_;
+    uring_tried_ = true;
+
+    try
+    {
+      uring_ = uring::create_ring(&loop_);
+    }
+    catch(uring::Setup_Error&) {}
+    return uring_;
+  }
+}
@@ -0,0 +1,68 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <uv.h>
+namespace ug
+{
+  namespace uring { struct Ring; }
+
+  /*!
+   * \brief An event loop shared by any number of io objects.
+   *
+   * Io objects constructed with a context register their handles with its
+   * loop and leave stepping to its owner, so servicing all of them costs a
+   * single loop run no matter how many there are.
+   *
+   * Io objects must be destroyed before their context.
+   */
+  struct IO_Context
+  {
+    IO_Context() noexcept;
+    ~IO_Context() noexcept;
+
+    IO_Context(IO_Context const&) = delete;
+    IO_Context& operator=(IO_Context const&) = delete;
+
+    /*!
+     * \brief Services every io object registered with the context.
+     *
+     * \param timeout Milliseconds to wait for something to happen if nothing
+     * is ready yet, zero to return immediately or negative to wait until
+     * something happens.
+     */
+    void step(int timeout = 0) noexcept;
+
+    uv_loop_t* loop() noexcept;
+
+    /*!
+     * \brief The io_uring shared by io objects using this context.
+     *
+     * It's set up the first time it's asked for. Null when io_uring can't
+     * be used here, in which case the caller should fall back to libuv.
+     */
+    uring::Ring* uring() noexcept;
+  private:
+    uv_loop_t loop_;
+    uv_timer_t timeout_timer_;
+
+    uring::Ring* uring_ = nullptr;
+    bool uring_tried_ = false;
+  };
+}
@@ -19,6 +19,8 @@
  */
 #include "ipc.h"
 #include <string>
+#include <cstring>
+#include <new>
 #include "common.h"
 
 namespace ug { namespace ipc
@@ -39,6 +41,8 @@ namespace ug { namespace ipc
   {
     self.buf = new buf_t();
     self.proc = proc;
+    self.dest_cb = nullptr;
+    self.reading_to_dest = false;
   }
 
   void uninit_pipe(Pipe& self) noexcept
@@ -71,17 +75,29 @@ namespace ug { namespace ipc
     uninit_pipe(self.out);
   }
 
-  void on_process_exit(uv_process_t* p, int64_t exit, int sig) noexcept
+  void on_process_handle_close(uv_handle_t* h) noexcept
   {
-    Process* proc = (Process*) p;
+    Process* proc = (Process*) h;
+    if(--proc->open_handles) return;
 
-    // Tidy up.
-    uv_run(proc->loop, UV_RUN_DEFAULT);
+    uninit_pipe(proc->io.in);
+    uninit_pipe(proc->io.out);
+    uninit_pipe(proc->err);
+    delete proc;
+  }
+  void on_pipe_handle_close(uv_handle_t* h) noexcept
+  {
+    on_process_handle_close((uv_handle_t*) ((Pipe*) h)->proc);
+  }
 
-    // Close the process then uninitialize.
-    uv_close((uv_handle_t*) proc, NULL);
+  void on_process_exit(uv_process_t* p, int64_t exit, int sig) noexcept
+  {
+    Process* proc = (Process*) p;
     proc->running = false;
-    delete_process(proc);
+    proc->exited = true;
+
+    // Nobody is left to close it otherwise.
+    if(proc->deleted) uv_close((uv_handle_t*) proc, on_process_handle_close);
   }
 
   Process* create_process(uv_loop_t* loop, const Spawn_Options& spawn_opt)
@@ -89,6 +105,10 @@ namespace ug { namespace ipc
     Process* self = new Process;
     self->loop = loop;
     self->running = false;
+    self->exited = false;
+    self->deleted = false;
+    // The process handle and the three pipes.
+    self->open_handles = 4;
 
     // Initialize pipes.
     init_duplex_pipe(self->io, self);
@@ -120,7 +140,7 @@ namespace ug { namespace ipc
 
     options.stdio = stdio;
 
-    // This callback closes the process handle and then calles delete_process.
+    // This callback closes the process handle if it was already deleted.
     options.exit_cb = on_process_exit;
 
     std::string proc_name(spawn_opt.args[0]);
@@ -141,21 +161,18 @@ namespace ug { namespace ipc
   {
     // Kill the process (if necessary)
     kill_process(self, SIGTERM);
-
-    // Tidy up all pending events.
-    uv_run(self->loop, UV_RUN_DEFAULT);
+    self->deleted = true;
 
     // Close and uninitialize pipes connected to the child process.
-    uv_close((uv_handle_t*) &self->io.in, NULL);
-    uninit_pipe(self->io.in);
+    uv_close((uv_handle_t*) &self->io.in, on_pipe_handle_close);
+    uv_close((uv_handle_t*) &self->io.out, on_pipe_handle_close);
+    uv_close((uv_handle_t*) &self->err, on_pipe_handle_close);
 
-    uv_close((uv_handle_t*) &self->io.out, NULL);
-    uninit_pipe(self->io.out);
-
-    uv_close((uv_handle_t*) &self->err, NULL);
-    uninit_pipe(self->err);
-
-    delete self;
+    // Wait for the exit callback to reap the process before closing it.
+    if(self->exited)
+    {
+      uv_close((uv_handle_t*) self, on_process_handle_close);
+    }
   }
 
   void kill_process(Process* proc, int signum)
@@ -169,58 +186,117 @@ namespace ug { namespace ipc
     proc->running = false;
   }
 
+  // Lives at the start of a pooled block, followed by its own copy of the
+  // data. Any number of them can be queued on a pipe at once.
   struct Write_Buf_Req
   {
     uv_write_t req;
+    uv_buf_t buf;
     Pipe* pipe;
     on_write_cb after_write;
+    std::size_t block_size;
   };
 
   void on_write_buffer(uv_write_t* r, int status)
   {
     Write_Buf_Req* req = (Write_Buf_Req*) r;
     if(req->after_write) req->after_write(req->pipe);
-    delete req;
+
+    // Gone along with the request.
+    std::size_t block_size = req->block_size;
+    req->~Write_Buf_Req();
+    io_buffer_pool().release((char*) req, block_size);
   }
   void write_buffer(Pipe* pipe, on_write_cb after_write) noexcept
   {
-    // I don't think the reinterpret cast will cause too many issues.
-    uv_buf_t buf = uv_buf_init(reinterpret_cast<char*>(&(*pipe->buf)[0]),
-                               pipe->buf->size());
+    write_buffer(pipe, pipe->buf->data(), pipe->buf->size(), after_write);
+  }
+  void write_buffer(Pipe* pipe, uchar const* data, std::size_t size,
+                    on_write_cb after_write) noexcept
+  {
+    std::size_t block_size = sizeof(Write_Buf_Req) + size;
+    char* block = io_buffer_pool().acquire(block_size);
 
-    Write_Buf_Req* req = new Write_Buf_Req;
+    Write_Buf_Req* req = new (block) Write_Buf_Req;
+    req->buf = uv_buf_init(block + sizeof(Write_Buf_Req), size);
     req->pipe = pipe;
     req->after_write = after_write;
+    req->block_size = block_size;
+    std::memcpy(req->buf.base, data, size);
 
-    uv_write((uv_write_t*) req, (uv_stream_t*) pipe, &buf, 1, on_write_buffer);
+    if(uv_write(&req->req, (uv_stream_t*) pipe, &req->buf, 1,
+                on_write_buffer))
+    {
+      req->~Write_Buf_Req();
+      io_buffer_pool().release(block, block_size);
+    }
   }
 
+  void alloc_raw(uv_handle_t* h, size_t size, uv_buf_t* buf)
+  {
+    Pipe* p = (Pipe*) h;
+
+    // Read a pooled block's worth, just not into one of ours.
+    std::size_t len = io_buffer_pool().block_size();
+    uchar* dest = p->dest_cb ? p->dest_cb(p, len) : nullptr;
+
+    p->reading_to_dest = dest;
+    if(!dest)
+    {
+      alloc(h, size, buf);
+      return;
+    }
+    buf->base = (char*) dest;
+    buf->len = len;
+  }
+  void collect_raw(uv_stream_t* s, ssize_t nread, const uv_buf_t* buf)
+  {
+    Pipe* p = (Pipe*) s;
+    if(nread < 0)
+    {
+      uv_read_stop(s);
+    }
+    else if(nread > 0)
+    {
+      // No copy, the action sees the chunk where it was read.
+      p->chunk = Buf_View{(uchar const*) buf->base, (std::size_t) nread};
+      p->action_cb(p);
+      p->chunk = Buf_View{};
+    }
+    if(!p->reading_to_dest) free_buf(buf);
+  }
   void collect_lines(uv_stream_t* s, ssize_t nread, const uv_buf_t* buf)
   {
     Pipe* p = (Pipe*) s;
-    if(nread == UV_EOF)
+    if(nread < 0)
     {
       // Call the action as long as the buffer is not empty.
       if(!p->buf->empty()) { p->action_cb(p); }
+      p->buf->clear();
       uv_read_stop(s);
     }
     else
     {
-      for(char* cur = buf->base; cur != buf->base + nread; ++cur)
+      char* cur = buf->base;
+      char* end = buf->base + nread;
+      while(cur != end)
       {
-        if(*cur == '\n')
+        char* line_end = (char*) std::memchr(cur, '\n', end - cur);
+        if(!line_end)
         {
-          if(!p->buf->empty()) { p->action_cb(p); }
-
-          // Clear the buffer.
-          p->buf->clear();
-        }
-        else
-        {
-          p->buf->push_back(*cur);
+          // Wait for the rest of the line.
+          p->buf->insert(p->buf->end(), cur, end);
+          break;
         }
+
+        p->buf->insert(p->buf->end(), cur, line_end);
+        if(!p->buf->empty()) { p->action_cb(p); }
+
+        // Clear the buffer.
+        p->buf->clear();
+        cur = line_end + 1;
       }
     }
-    delete[] buf->base;
+    free_buf(buf);
   }
 } }
@@ -31,6 +31,16 @@ namespace ug { namespace ipc
     Process* proc;
     void (*action_cb)(Pipe* p);
     void* user_data;
+
+    // With raw framing, the chunk the action is called for. It points to
+    // the read buffer, buf is left alone.
+    Buf_View chunk;
+
+    // With raw framing, returns where to read to instead of a pooled
+    // buffer, or null to use one anyway.
+    uchar* (*dest_cb)(Pipe* p, std::size_t size);
+    // Whether the read in progress goes to what dest_cb returned.
+    bool reading_to_dest;
   };
 
   Pipe* create_pipe(Process* = nullptr) noexcept;
@@ -50,7 +60,10 @@ namespace ug { namespace ipc
   void uninit_duplex_pipe(Duplex_Pipe& self) noexcept;
 
   using on_write_cb = void (*)(Pipe*);
+  // Both copy what they write, the source can be reused right away.
   void write_buffer(Pipe* pipe, on_write_cb after_write = nullptr) noexcept;
+  void write_buffer(Pipe* pipe, uchar const* data, std::size_t size,
+                    on_write_cb after_write = nullptr) noexcept;
 
   struct Kill_Error
   {
@@ -77,11 +90,39 @@ namespace ug { namespace ipc
     Pipe err;
     uv_loop_t* loop;
     bool running;
+    // Set once the exit callback has been called.
+    bool exited;
+    // Set by delete_process, the process is freed once its handles close.
+    bool deleted;
+    int open_handles;
   };
 
   Process* create_process(uv_loop_t* loop, const Spawn_Options& spawn_opt);
+
+  /*!
+   * \brief Kills the process and closes its pipes.
+   *
+   * This doesn't run the loop, which may be shared. The process is freed on
+   * a later run of the loop, once the process exited and every handle is
+   * closed.
+   */
   void delete_process(Process*) noexcept;
   void kill_process(Process*, int signum);
 
+  /*!
+   * \brief How a pipe's output is split before it's handed to its action.
+   */
+  enum class Framing
+  {
+    // Whole chunks as they are read, for self-delimiting formats like
+    // msgpack.
+    Raw,
+    // One line at a time, without the newline.
+    Lines
+  };
+
+  // Allocator to use with collect_raw, it asks the pipe's dest_cb if any.
+  void alloc_raw(uv_handle_t* h, size_t size, uv_buf_t* buf);
+  void collect_raw(uv_stream_t* s, ssize_t nread, const uv_buf_t* buf);
   void collect_lines(uv_stream_t* s, ssize_t nread, const uv_buf_t* buf);
 } };
@@ -18,7 +18,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "net.h"
+#include <cstring>
+#include <new>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "common.h"
+#include "../common/thread_local.h"
+
+// Batches of datagrams come with a flag telling us when to free the buffer
+// since 1.40.
+#if UV_VERSION_MAJOR > 1 || (UV_VERSION_MAJOR == 1 && UV_VERSION_MINOR >= 40)
+  #define UG_UDP_RECVMMSG
+#endif
 
 namespace ug { namespace net
 {
@@ -33,36 +44,76 @@ namespace ug { namespace net
     uninit_udp_handle(*self);
     delete self;
   }
-  void init_udp_handle(UDP_Handle& self, uv_loop_t* loop) noexcept
+  void init_udp_handle(UDP_Handle& self, uv_loop_t* loop,
+                       unsigned int flags) noexcept
   {
-    self.buf = new buf_t();
-    uv_udp_init(loop, &self.handle);
+    uv_udp_init_ex(loop, &self.handle, flags);
   }
   void uninit_udp_handle(UDP_Handle& self) noexcept
   {
-    delete self.buf;
     uv_close((uv_handle_t*) &self.handle, NULL);
   }
 
+  namespace
+  {
+#ifdef UG_UDP_RECVMMSG
+    // libuv only uses recvmmsg if the buffer fits more than one datagram of
+    // the biggest size, it then splits it up to receive this many at once.
+    constexpr std::size_t Batch_Size = 16 * 64 * 1024;
+
+    UG_THREAD_LOCAL Thread_Pool_Storage batch_pool_storage_;
+    UG_THREAD_LOCAL Buffer_Pool* batch_pool_ = nullptr;
+
+    Buffer_Pool& batch_pool() noexcept
+    {
+      if(!batch_pool_)
+      {
+        batch_pool_ = make_thread_pool(batch_pool_storage_, Batch_Size, 4);
+      }
+      return *batch_pool_;
+    }
+
+    void alloc_batch(uv_handle_t*, size_t, uv_buf_t* buf) noexcept
+    {
+      buf->base = batch_pool().acquire(Batch_Size);
+      buf->len = Batch_Size;
+    }
+    void free_batch(uv_buf_t const* buf) noexcept
+    {
+      batch_pool().release(buf->base, buf->len);
+    }
+#else
+    void alloc_batch(uv_handle_t* h, size_t size, uv_buf_t* buf) noexcept
+    {
+      alloc(h, size, buf);
+    }
+    void free_batch(uv_buf_t const* buf) noexcept
+    {
+      free_buf(buf);
+    }
+#endif
+  }
+
   void recieve_udp(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf,
                    const struct sockaddr* addr, unsigned flags) noexcept
   {
     Pipe* pipe = (Pipe*) handle;
 
-    // If we are given the nothing-to-read notification, flush the buffer.
-    if(nread == 0 && addr == nullptr)
+    // One datagram at a time, right where it was received. Empty datagrams
+    // are as good as nothing to us.
+    if(nread > 0)
     {
+      pipe->chunk = Buf_View{(uchar const*) buf->base, (std::size_t) nread};
       if(pipe->read_cb) pipe->read_cb(pipe);
-      pipe->in.buf->clear();
-    }
-
-    for(char* cur = buf->base; cur != buf->base + nread; ++cur)
-    {
-      pipe->in.buf->push_back(*cur);
+      pipe->chunk = Buf_View{};
     }
 
-    // Unallocate the buffer.
-    delete[] buf->base;
+#ifdef UG_UDP_RECVMMSG
+    // Datagrams received in a batch are all part of one buffer, which is
+    // given back once at the end.
+    if(flags & UV_UDP_MMSG_CHUNK) return;
+#endif
+    free_batch(buf);
   }
 
   Pipe* create_pipe(uv_loop_t* loop, std::string const& bind_ip,
@@ -72,19 +123,36 @@ namespace ug { namespace net
     init_pipe(*self, loop, bind_ip, port);
     return self;
   }
-  void delete_pipe(Pipe* self) noexcept
+  void on_pipe_handle_close(uv_handle_t* h) noexcept
   {
-    uninit_pipe(*self);
+    Pipe* self = (Pipe*) h->data;
+    if(--self->open_handles) return;
+
     delete self;
   }
+  void delete_pipe(Pipe* self) noexcept
+  {
+    uv_udp_recv_stop(&self->in.handle);
+
+    self->open_handles = 2;
+    self->in.handle.data = self;
+    self->out.handle.data = self;
+    uv_close((uv_handle_t*) &self->in.handle, on_pipe_handle_close);
+    uv_close((uv_handle_t*) &self->out.handle, on_pipe_handle_close);
+  }
   void init_pipe(Pipe& self, uv_loop_t* loop,
                  std::string const& bind_ip, uint16_t const port)
   {
     self.user_data = nullptr;
     self.read_cb = nullptr;
     self.write_cb = nullptr;
+    self.open_handles = 0;
 
+#ifdef UG_UDP_RECVMMSG
+    init_udp_handle(self.in, loop, UV_UDP_RECVMMSG);
+#else
     init_udp_handle(self.in, loop);
+#endif
     init_udp_handle(self.out, loop);
 
     // Bind the input socket to accept all connections.
@@ -95,7 +163,7 @@ namespace ug { namespace net
     }
 
     uv_udp_bind(&self.in.handle, (sockaddr*) &addr, 0);
-    uv_udp_recv_start(&self.in.handle, alloc, recieve_udp);
+    uv_udp_recv_start(&self.in.handle, alloc_batch, recieve_udp);
   }
   void uninit_pipe(Pipe& self) noexcept
   {
@@ -106,28 +174,316 @@ namespace ug { namespace net
   }
 
   namespace {
+    // Lives at the start of a pooled block, followed by its datagram.
     struct Send_Req
     {
       uv_udp_send_t req;
       uv_buf_t buf;
       Pipe* pipe;
+      std::size_t block_size;
     };
     void after_write(uv_udp_send_t* r, int status)
     {
       Send_Req* req = (Send_Req*) r;
       if(req->pipe->write_cb) req->pipe->write_cb(req->pipe);
-      delete req;
+
+      // Gone along with the request.
+      std::size_t block_size = req->block_size;
+      req->~Send_Req();
+      io_buffer_pool().release((char*) req, block_size);
     }
   }
-  void write_buffer(Pipe& p, sockaddr const* dest) noexcept
+  void send(Pipe& p, uchar const* data, std::size_t size,
+            sockaddr const* dest) noexcept
   {
-    Send_Req* req = new Send_Req;
-    req->pipe = &p;
+    uv_buf_t buf = uv_buf_init((char*) data, size);
+
+    // Most of the time the socket isn't busy and the datagram can go out
+    // right away, straight from the caller's buffer. This fails if sends are
+    // already queued, which keeps them in order.
+    if(uv_udp_try_send(&p.out.handle, &buf, 1, dest) == (int) size)
+    {
+      if(p.write_cb) p.write_cb(&p);
+      return;
+    }
 
-    // Why is this such an issue?
-    req->buf.base = reinterpret_cast<char*>(p.out.buf->data());
-    req->buf.len = p.out.buf->size();
+    // Otherwise queue a copy, which is ours until after_write.
+    std::size_t block_size = sizeof(Send_Req) + size;
+    char* block = io_buffer_pool().acquire(block_size);
+
+    Send_Req* req = new (block) Send_Req;
+    req->pipe = &p;
+    req->block_size = block_size;
+    req->buf = uv_buf_init(block + sizeof(Send_Req), size);
+    std::memcpy(req->buf.base, data, size);
 
     uv_udp_send(&req->req, &p.out.handle, &req->buf, 1, dest, after_write);
   }
+
+  namespace
+  {
+    void init_stream_handle(Stream_Handle& h, uv_loop_t* loop,
+                            Stream_Kind kind) noexcept
+    {
+      if(kind == Stream_Kind::Tcp)
+      {
+        uv_tcp_init(loop, &h.tcp);
+        // Messages are small and someone is usually waiting on them.
+        uv_tcp_nodelay(&h.tcp, 1);
+      }
+      else
+      {
+        uv_pipe_init(loop, &h.pipe, 0);
+      }
+    }
+
+    Stream* new_stream(uv_loop_t* loop, Stream_Kind kind) noexcept
+    {
+      Stream* self = new Stream;
+      init_stream_handle(self->handle, loop, kind);
+      self->handle.stream.data = self;
+      self->user_data = nullptr;
+      self->read_cb = nullptr;
+      self->dest_cb = nullptr;
+      self->reading_to_dest = false;
+      self->open = true;
+      return self;
+    }
+
+    void alloc_stream(uv_handle_t* h, size_t size, uv_buf_t* buf) noexcept
+    {
+      Stream* self = (Stream*) h->data;
+
+      // Read a pooled block's worth, just not into one of ours.
+      std::size_t len = io_buffer_pool().block_size();
+      uchar* dest = self->dest_cb ? self->dest_cb(self, len) : nullptr;
+
+      self->reading_to_dest = dest;
+      if(!dest)
+      {
+        alloc(h, size, buf);
+        return;
+      }
+      buf->base = (char*) dest;
+      buf->len = len;
+    }
+    void read_stream(uv_stream_t* s, ssize_t nread,
+                     const uv_buf_t* buf) noexcept
+    {
+      Stream* self = (Stream*) s->data;
+      if(nread < 0)
+      {
+        // The peer hung up.
+        self->open = false;
+        uv_read_stop(s);
+      }
+      else if(nread > 0)
+      {
+        self->chunk = Buf_View{(uchar const*) buf->base, (std::size_t) nread};
+        if(self->read_cb) self->read_cb(self);
+        self->chunk = Buf_View{};
+      }
+      if(!self->reading_to_dest) free_buf(buf);
+    }
+
+    void on_connect(uv_connect_t* req, int status) noexcept
+    {
+      Stream* self = (Stream*) req->handle->data;
+      if(status < 0)
+      {
+        self->open = false;
+        return;
+      }
+      uv_read_start(&self->handle.stream, alloc_stream, read_stream);
+    }
+
+    // Lives at the start of a pooled block, followed by its data.
+    struct Stream_Write_Req
+    {
+      uv_write_t req;
+      uv_buf_t buf;
+      std::size_t block_size;
+    };
+    void after_stream_write(uv_write_t* r, int) noexcept
+    {
+      Stream_Write_Req* req = (Stream_Write_Req*) r;
+      // Gone along with the request.
+      std::size_t block_size = req->block_size;
+      req->~Stream_Write_Req();
+      io_buffer_pool().release((char*) req, block_size);
+    }
+  }
+
+  Stream* connect_stream(uv_loop_t* loop, Endpoint const& endpoint)
+  {
+    if(endpoint.kind == Stream_Kind::Tcp)
+    {
+      struct sockaddr_in addr;
+      if(uv_ip4_addr(endpoint.address.c_str(), endpoint.port, &addr))
+      {
+        throw Connect_Error{endpoint.address};
+      }
+
+      Stream* self = new_stream(loop, Stream_Kind::Tcp);
+      if(uv_tcp_connect(&self->connect_req, &self->handle.tcp,
+                        (sockaddr*) &addr, on_connect))
+      {
+        self->open = false;
+      }
+      return self;
+    }
+
+    Stream* self = new_stream(loop, Stream_Kind::Unix);
+    uv_pipe_connect(&self->connect_req, &self->handle.pipe,
+                    endpoint.address.c_str(), on_connect);
+    return self;
+  }
+  Stream* open_stream(uv_loop_t* loop, int fd) noexcept
+  {
+    // Unix sockets and pipes both go through a uv_pipe_t.
+    bool tcp = uv_guess_handle(fd) == UV_TCP;
+    Stream* self = new_stream(loop, tcp ? Stream_Kind::Tcp : Stream_Kind::Unix);
+
+    int err = tcp ? uv_tcp_open(&self->handle.tcp, fd)
+                  : uv_pipe_open(&self->handle.pipe, fd);
+    if(err)
+    {
+      close(fd);
+      self->open = false;
+      return self;
+    }
+    uv_read_start(&self->handle.stream, alloc_stream, read_stream);
+    return self;
+  }
+  void delete_stream(Stream* self) noexcept
+  {
+    uv_read_stop(&self->handle.stream);
+    uv_close((uv_handle_t*) &self->handle, [](uv_handle_t* h)
+    {
+      delete (Stream*) h->data;
+    });
+  }
+
+  void write_stream(Stream& s, uchar const* data, std::size_t size) noexcept
+  {
+    if(!s.open || !size) return;
+
+    // Like send, write straight from the caller's buffer when the socket
+    // isn't busy. This fails while writes are queued, keeping them in order.
+    uv_buf_t buf = uv_buf_init((char*) data, size);
+    int written = uv_try_write(&s.handle.stream, &buf, 1);
+    if(written == (int) size) return;
+    if(written < 0 && written != UV_EAGAIN && written != UV_ENOSYS) return;
+    if(written > 0)
+    {
+      data += written;
+      size -= written;
+    }
+
+    // Queue a copy of the rest.
+    std::size_t block_size = sizeof(Stream_Write_Req) + size;
+    char* block = io_buffer_pool().acquire(block_size);
+
+    Stream_Write_Req* req = new (block) Stream_Write_Req;
+    req->block_size = block_size;
+    req->buf = uv_buf_init(block + sizeof(Stream_Write_Req), size);
+    std::memcpy(req->buf.base, data, size);
+
+    if(uv_write(&req->req, &s.handle.stream, &req->buf, 1,
+                after_stream_write))
+    {
+      req->~Stream_Write_Req();
+      io_buffer_pool().release(block, block_size);
+    }
+  }
+
+  namespace
+  {
+    void on_connection(uv_stream_t* server, int status) noexcept
+    {
+      if(status < 0) return;
+
+      Listener* self = (Listener*) server->data;
+      if(self->connection_cb) self->connection_cb(self);
+    }
+
+    // Removes a socket left over at path, anything else there is left alone
+    // so binding fails instead.
+    void unlink_socket(std::string const& path) noexcept
+    {
+      struct stat st;
+      if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+      {
+        unlink(path.c_str());
+      }
+    }
+  }
+
+  Listener* create_listener(uv_loop_t* loop, Endpoint const& endpoint)
+  {
+    Listener* self = new Listener;
+    self->endpoint = endpoint;
+    self->user_data = nullptr;
+    self->connection_cb = nullptr;
+    init_stream_handle(self->handle, loop, endpoint.kind);
+    self->handle.stream.data = self;
+
+    int err;
+    if(endpoint.kind == Stream_Kind::Tcp)
+    {
+      struct sockaddr_in addr;
+      err = uv_ip4_addr(endpoint.address.c_str(), endpoint.port, &addr);
+      if(!err) err = uv_tcp_bind(&self->handle.tcp, (sockaddr*) &addr, 0);
+    }
+    else
+    {
+      unlink_socket(endpoint.address);
+      err = uv_pipe_bind(&self->handle.pipe, endpoint.address.c_str());
+    }
+    if(!err) err = uv_listen(&self->handle.stream, SOMAXCONN, on_connection);
+
+    if(err)
+    {
+      uv_close((uv_handle_t*) &self->handle, [](uv_handle_t* h)
+      {
+        delete (Listener*) h->data;
+      });
+      throw Bind_Error{endpoint.address};
+    }
+    return self;
+  }
+  void delete_listener(Listener* self) noexcept
+  {
+    if(self->endpoint.kind == Stream_Kind::Unix)
+    {
+      unlink_socket(self->endpoint.address);
+    }
+    uv_close((uv_handle_t*) &self->handle, [](uv_handle_t* h)
+    {
+      delete (Listener*) h->data;
+    });
+  }
+
+  uint16_t listener_port(Listener const& self) noexcept
+  {
+    if(self.endpoint.kind != Stream_Kind::Tcp) return 0;
+
+    struct sockaddr_in addr;
+    int len = sizeof(addr);
+    uv_tcp_getsockname(&self.handle.tcp, (sockaddr*) &addr, &len);
+    return ntohs(addr.sin_port);
+  }
+
+  Stream* accept_stream(Listener& listener) noexcept
+  {
+    Stream* self = new_stream(listener.handle.stream.loop,
+                              listener.endpoint.kind);
+    if(uv_accept(&listener.handle.stream, &self->handle.stream))
+    {
+      delete_stream(self);
+      return nullptr;
+    }
+    uv_read_start(&self->handle.stream, alloc_stream, read_stream);
+    return self;
+  }
 } }
@@ -35,12 +35,13 @@ namespace ug { namespace net
   struct UDP_Handle
   {
     uv_udp_t handle;
-    buf_t* buf;
   };
 
   UDP_Handle* create_udp_handle(uv_loop_t*) noexcept;
   void delete_udp_handle(UDP_Handle*) noexcept;
-  void init_udp_handle(UDP_Handle&, uv_loop_t*) noexcept;
+  // Flags are passed on to uv_udp_init_ex.
+  void init_udp_handle(UDP_Handle&, uv_loop_t*,
+                       unsigned int flags = 0) noexcept;
   void uninit_udp_handle(UDP_Handle&) noexcept;
 
   struct Pipe
@@ -51,13 +52,26 @@ namespace ug { namespace net
     void* user_data;
 
     using action_cb = void(*)(Pipe*);
+    // Called with every datagram in chunk.
     action_cb read_cb;
     action_cb write_cb;
+
+    // Handles delete_pipe is still waiting on.
+    int open_handles;
+
+    // The datagram read_cb is called for, where it was received.
+    Buf_View chunk;
   };
 
   Pipe* create_pipe(uv_loop_t*, std::string const& bind_ip,
                     uint16_t const port);
 
+  /*!
+   * \brief Closes the pipe's handles.
+   *
+   * This doesn't run the loop, which may be shared. The pipe is freed on a
+   * later run of the loop, once both handles are closed.
+   */
   void delete_pipe(Pipe*) noexcept;
 
   void init_pipe(Pipe&, uv_loop_t*, std::string const& bind_ip,
@@ -65,5 +79,135 @@ namespace ug { namespace net
 
   void uninit_pipe(Pipe&) noexcept;
 
-  void write_buffer(Pipe& p, sockaddr const* dest) noexcept;
+  /*!
+   * \brief Sends one datagram.
+   *
+   * The data is copied if it can't be sent right away, so the caller can
+   * reuse it as soon as this returns.
+   */
+  void send(Pipe& p, uchar const* data, std::size_t size,
+            sockaddr const* dest) noexcept;
+
+  // Stream sockets, for plugins that connect to an engine that's already
+  // running instead of being spawned by it.
+
+  struct Connect_Error
+  {
+    const std::string& address;
+  };
+
+  enum class Stream_Kind
+  {
+    Unix, Tcp
+  };
+
+  /*!
+   * \brief Where to listen or connect to.
+   *
+   * For Unix sockets the address is a path and the port is unused.
+   */
+  struct Endpoint
+  {
+    Stream_Kind kind;
+    std::string address;
+    uint16_t port;
+  };
+
+  inline Endpoint unix_endpoint(std::string const& path) noexcept
+  {
+    return Endpoint{Stream_Kind::Unix, path, 0};
+  }
+  inline Endpoint tcp_endpoint(std::string const& ip, uint16_t port) noexcept
+  {
+    return Endpoint{Stream_Kind::Tcp, ip, port};
+  }
+
+  union Stream_Handle
+  {
+    uv_stream_t stream;
+    uv_tcp_t tcp;
+    uv_pipe_t pipe;
+  };
+
+  struct Stream
+  {
+    Stream_Handle handle;
+    uv_connect_t connect_req;
+
+    void* user_data;
+
+    using action_cb = void(*)(Stream*);
+    // Called with every chunk read, in chunk.
+    action_cb read_cb;
+    Buf_View chunk;
+
+    // Returns where to read to instead of a pooled buffer, or null to use
+    // one anyway.
+    uchar* (*dest_cb)(Stream*, std::size_t size);
+    // Whether the read in progress goes to what dest_cb returned.
+    bool reading_to_dest;
+
+    // False once the peer hangs up or the connection fails.
+    bool open;
+  };
+
+  /*!
+   * \brief Starts connecting, writes are queued until the connection is up.
+   *
+   * \throws Connect_Error if the address can't be parsed.
+   */
+  Stream* connect_stream(uv_loop_t*, Endpoint const&);
+
+  /*!
+   * \brief Takes over a connected socket or a pipe.
+   *
+   * If libuv can't use the fd it's closed and the stream isn't open.
+   */
+  Stream* open_stream(uv_loop_t*, int fd) noexcept;
+
+  /*!
+   * \brief Closes the stream.
+   *
+   * Like delete_pipe, the stream is freed on a later run of the loop.
+   */
+  void delete_stream(Stream*) noexcept;
+
+  /*!
+   * \brief Writes data to the stream.
+   *
+   * Whatever can't be written right away is copied, so the caller can reuse
+   * the data as soon as this returns.
+   */
+  void write_stream(Stream& s, uchar const* data, std::size_t size) noexcept;
+
+  struct Listener
+  {
+    Stream_Handle handle;
+    Endpoint endpoint;
+
+    void* user_data;
+
+    // Called for every connection waiting for accept_stream.
+    void (*connection_cb)(Listener*);
+  };
+
+  /*!
+   * \brief Starts listening for connections.
+   *
+   * A Unix socket left behind at the same path is replaced.
+   *
+   * \throws Bind_Error
+   */
+  Listener* create_listener(uv_loop_t*, Endpoint const&);
+  void delete_listener(Listener*) noexcept;
+
+  // The port actually bound, useful when listening on port 0.
+  uint16_t listener_port(Listener const&) noexcept;
+
+  /*!
+   * \brief Accepts a connection and starts reading from it.
+   *
+   * \returns nullptr if the connection went away in the meantime.
+   */
+  Stream* accept_stream(Listener&) noexcept;
 } }
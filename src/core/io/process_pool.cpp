@@ -0,0 +1,148 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "process_pool.h"
+#include <algorithm>
+#include "common.h"
+namespace ug
+{
+  namespace
+  {
+    constexpr char Ready_Msg[] = "PpM";
+    constexpr std::size_t Ready_Size = sizeof(Ready_Msg) - 1;
+
+    // How long claim waits on the loop at a time for a process to get ready.
+    constexpr int Claim_Wait_Ms = 10;
+  }
+
+  Process_Pool::Process_Pool(ipc::Spawn_Options const& opt,
+                             std::size_t size, IO_Context& ctx)
+    : ctx_(ctx), has_cwd_(opt.cwd)
+  {
+    for(char** arg = opt.args; *arg; ++arg) args_.emplace_back(*arg);
+    for(std::string& arg : args_) arg_ptrs_.push_back(&arg[0]);
+    arg_ptrs_.push_back(NULL);
+    if(has_cwd_) cwd_ = opt.cwd;
+
+    for(std::size_t i = 0; i < size; ++i) spawn_();
+  }
+  Process_Pool::~Process_Pool() noexcept
+  {
+    // The context finishes closing them.
+    for(auto& pooled : procs_) ipc::delete_process(pooled->process);
+  }
+
+  std::size_t Process_Pool::ready() const noexcept
+  {
+    return std::count_if(procs_.begin(), procs_.end(),
+    [](std::unique_ptr<Pooled> const& pooled)
+    {
+      return pooled->ready && pooled->process->running;
+    });
+  }
+
+  std::unique_ptr<Child_Process> Process_Pool::claim(ipc::Framing framing)
+  {
+    // Processes that died are replaced once we are done waiting, so one that
+    // can't start up doesn't keep us here.
+    std::size_t died = 0;
+    auto iter = procs_.end();
+    while(true)
+    {
+      // Get rid of the ones that didn't make it.
+      for(auto dead = procs_.begin(); dead != procs_.end();)
+      {
+        if((*dead)->process->running)
+        {
+          ++dead;
+          continue;
+        }
+        ipc::delete_process((*dead)->process);
+        dead = procs_.erase(dead);
+        ++died;
+      }
+
+      iter = std::find_if(procs_.begin(), procs_.end(),
+      [](std::unique_ptr<Pooled> const& pooled)
+      {
+        return pooled->ready;
+      });
+      if(iter != procs_.end() || procs_.empty()) break;
+
+      // Handing one over early would pass its ready message on as output.
+      ctx_.step(Claim_Wait_Ms);
+    }
+
+    for(; died; --died) spawn_();
+    if(iter == procs_.end()) return nullptr;
+
+    ipc::Process* process = (*iter)->process;
+    procs_.erase(iter);
+
+    // The process reads its own output from now on.
+    uv_read_stop((uv_stream_t*) &process->io.in);
+    std::unique_ptr<Child_Process> ret{
+      new Child_Process{process, Maybe_Owned<IO_Context>{&ctx_, false},
+                        framing}};
+
+    spawn_();
+    return ret;
+  }
+
+  void Process_Pool::spawn_()
+  {
+    ipc::Spawn_Options opt;
+    opt.args = &arg_ptrs_[0];
+    opt.cwd = has_cwd_ ? cwd_.c_str() : NULL;
+
+    auto pooled = std::make_unique<Pooled>();
+    pooled->process = ipc::create_process(ctx_.loop(), opt);
+    pooled->matched = 0;
+    pooled->ready = false;
+
+    // Only watch for the ready message until the process is claimed.
+    pooled->process->io.in.user_data = pooled.get();
+    pooled->process->io.in.action_cb = on_output_;
+    uv_read_start((uv_stream_t*) &pooled->process->io.in, ipc::alloc_raw,
+                  ipc::collect_raw);
+
+    procs_.push_back(std::move(pooled));
+  }
+
+  void Process_Pool::on_output_(ipc::Pipe* p) noexcept
+  {
+    Pooled* pooled = (Pooled*) p->user_data;
+    if(pooled->ready) return;
+
+    // The message may come in pieces. Plugins shouldn't say anything else
+    // until they get the header, if they do it's dropped. The message can
+    // only start over with its first character.
+    for(uchar c : p->chunk)
+    {
+      if(c == Ready_Msg[pooled->matched]) ++pooled->matched;
+      else pooled->matched = c == Ready_Msg[0] ? 1 : 0;
+
+      if(pooled->matched == Ready_Size)
+      {
+        pooled->ready = true;
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,91 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "external_io.h"
+#include "io_context.h"
+#include "ipc.h"
+namespace ug
+{
+  /*!
+   * \brief Plugin processes started ahead of time, to be claimed later.
+   *
+   * Every process is spawned right away, so they all start up at the same
+   * time. A pooled plugin writes "PpM" once it's started up, then waits for
+   * the usual "PpM" header before doing anything else. That header is only
+   * sent once the process is claimed.
+   */
+  struct Process_Pool
+  {
+    // \throws ipc::Spawn_Error
+    Process_Pool(ipc::Spawn_Options const& opt, std::size_t size,
+                 IO_Context& ctx);
+    // Kills every process that wasn't claimed.
+    ~Process_Pool() noexcept;
+
+    Process_Pool(Process_Pool const&) = delete;
+    Process_Pool& operator=(Process_Pool const&) = delete;
+
+    // Processes that said they are ready.
+    std::size_t ready() const noexcept;
+    inline std::size_t size() const noexcept;
+
+    /*!
+     * \brief Hands over a ready process and spawns another one to replace
+     * it.
+     *
+     * If none is ready yet this steps the context until one is. Processes
+     * that died while waiting are replaced afterwards. Null if every process
+     * in the pool died before it got ready.
+     *
+     * \throws ipc::Spawn_Error
+     */
+    std::unique_ptr<Child_Process>
+      claim(ipc::Framing framing = ipc::Framing::Raw);
+  private:
+    struct Pooled
+    {
+      ipc::Process* process;
+      // How much of the ready message made it so far.
+      std::size_t matched;
+      bool ready;
+    };
+
+    void spawn_();
+    static void on_output_(ipc::Pipe* p) noexcept;
+
+    IO_Context& ctx_;
+
+    // The options are copied, along with everything they point to.
+    std::vector<std::string> args_;
+    std::vector<char*> arg_ptrs_;
+    std::string cwd_;
+    bool has_cwd_;
+
+    std::vector<std::unique_ptr<Pooled> > procs_;
+  };
+
+  inline std::size_t Process_Pool::size() const noexcept
+  {
+    return procs_.size();
+  }
+}
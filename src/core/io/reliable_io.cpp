@@ -0,0 +1,283 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "reliable_io.h"
+#include <algorithm>
+namespace ug
+{
+  // Every datagram starts with its type.
+  //
+  // Data: type, sequence number (4 bytes), index of the fragment in its
+  // message (2 bytes), fragments in the message (2 bytes), payload.
+  //
+  // Ack: type, the sequence number we are waiting for (4 bytes), a bitmap of
+  // the 32 after that which were received anyway (4 bytes).
+  //
+  // Numbers are big endian.
+  enum class Datagram_Type : uchar
+  {
+    Data = 0, Ack = 1
+  };
+
+  constexpr std::size_t Header_Size = 9;
+  constexpr std::size_t Sack_Bits = 32;
+  constexpr unsigned int Max_Backoff = 6;
+  constexpr std::size_t Max_Fragments = 0xffff;
+
+  namespace
+  {
+    void put_u16(buf_t& buf, std::uint16_t v) noexcept
+    {
+      buf.push_back(v >> 8);
+      buf.push_back(v);
+    }
+    void put_u32(buf_t& buf, std::uint32_t v) noexcept
+    {
+      put_u16(buf, v >> 16);
+      put_u16(buf, v);
+    }
+    std::uint16_t get_u16(buf_t const& buf, std::size_t pos) noexcept
+    {
+      return (buf[pos] << 8) | buf[pos + 1];
+    }
+    std::uint32_t get_u32(buf_t const& buf, std::size_t pos) noexcept
+    {
+      return (std::uint32_t(get_u16(buf, pos)) << 16) | get_u16(buf, pos + 2);
+    }
+
+    // Sequence numbers wrap around, so only their difference is meaningful.
+    std::int32_t seq_diff(std::uint32_t a, std::uint32_t b) noexcept
+    {
+      return static_cast<std::int32_t>(a - b);
+    }
+
+    std::size_t round_up_pow2(std::size_t n) noexcept
+    {
+      std::size_t ret = 1;
+      while(ret < n) ret *= 2;
+      return ret;
+    }
+  }
+
+  Reliable_IO::Reliable_IO(std::unique_ptr<External_IO> io,
+                           Reliable_Options opts) noexcept
+    : io_(std::move(io)), opts_(opts)
+  {
+    // Slots are picked with the sequence number modulo the window, which
+    // has to keep working when sequence numbers wrap around.
+    opts_.window = round_up_pow2(std::max<std::size_t>(opts_.window, 2));
+    opts_.max_payload = std::max<std::size_t>(opts_.max_payload, 1);
+    in_window_.resize(opts_.window);
+
+    io_->set_read_callback([this](buf_t const& buf)
+    {
+      on_datagram_(buf);
+    });
+    io_->set_error_callback([this](buf_t const& buf)
+    {
+      post_error(buf);
+    });
+  }
+
+  void Reliable_IO::write(buf_t const& buf) noexcept
+  {
+    io_stats_.count_write(buf.size());
+    Scoped_Timer timer{io_stats_.write_time};
+
+    // Empty messages still take a datagram.
+    std::size_t count = (buf.size() + opts_.max_payload - 1) /
+                        opts_.max_payload;
+    count = std::max<std::size_t>(count, 1);
+
+    // Too big to be put back together.
+    if(count > Max_Fragments) return;
+
+    auto now = clock_t::now();
+    for(std::size_t i = 0; i < count; ++i)
+    {
+      auto begin = buf.begin() + std::min(buf.size(), i * opts_.max_payload);
+      auto end = buf.begin() + std::min(buf.size(),
+                                        (i + 1) * opts_.max_payload);
+
+      Out_Datagram datagram;
+      datagram.data.reserve(Header_Size + (end - begin));
+      datagram.data.push_back(static_cast<uchar>(Datagram_Type::Data));
+      put_u32(datagram.data, out_base_ + out_.size());
+      put_u16(datagram.data, i);
+      put_u16(datagram.data, count);
+      datagram.data.insert(datagram.data.end(), begin, end);
+
+      // Send it right away if the window has room, otherwise step will once
+      // earlier datagrams are acknowledged.
+      if(out_.size() < opts_.window)
+      {
+        io_->write(datagram.data);
+        datagram.sent = true;
+        datagram.sent_at = now;
+        ++stats_.datagrams_sent;
+      }
+      out_.push_back(std::move(datagram));
+    }
+  }
+
+  void Reliable_IO::step() noexcept
+  {
+    io_->step();
+
+    if(ack_pending_) send_ack_();
+    send_datagrams_();
+  }
+
+  void Reliable_IO::send_datagrams_() noexcept
+  {
+    auto now = clock_t::now();
+
+    std::size_t in_window = std::min(out_.size(), opts_.window);
+    for(std::size_t i = 0; i < in_window; ++i)
+    {
+      Out_Datagram& datagram = out_[i];
+      if(datagram.acked) continue;
+
+      if(!datagram.sent)
+      {
+        datagram.sent = true;
+        ++stats_.datagrams_sent;
+      }
+      else
+      {
+        auto timeout = opts_.retransmit_timeout *
+                       (1 << std::min(datagram.retries, Max_Backoff));
+        if(now - datagram.sent_at < timeout) continue;
+
+        ++datagram.retries;
+        ++stats_.retransmits;
+      }
+
+      io_->write(datagram.data);
+      datagram.sent_at = now;
+    }
+  }
+
+  void Reliable_IO::send_ack_() noexcept
+  {
+    std::uint32_t sack = 0;
+    std::size_t bits = std::min(Sack_Bits, opts_.window - 1);
+    for(std::size_t i = 0; i < bits; ++i)
+    {
+      if(!in_window_[(in_next_ + 1 + i) % opts_.window].empty())
+      {
+        sack |= std::uint32_t(1) << i;
+      }
+    }
+
+    datagram_buf_.clear();
+    datagram_buf_.push_back(static_cast<uchar>(Datagram_Type::Ack));
+    put_u32(datagram_buf_, in_next_);
+    put_u32(datagram_buf_, sack);
+    io_->write(datagram_buf_);
+
+    ack_pending_ = false;
+    ++stats_.acks_sent;
+  }
+
+  void Reliable_IO::on_datagram_(buf_t const& buf) noexcept
+  {
+    // Anything that doesn't look right is dropped, the other side will send
+    // it again anyway.
+    if(buf.size() < Header_Size) return;
+
+    switch(static_cast<Datagram_Type>(buf[0]))
+    {
+      case Datagram_Type::Data:
+        on_data_(buf);
+        break;
+      case Datagram_Type::Ack:
+        on_ack_(buf);
+        break;
+    }
+  }
+
+  void Reliable_IO::on_data_(buf_t const& buf) noexcept
+  {
+    std::uint32_t seq = get_u32(buf, 1);
+    if(get_u16(buf, 5) >= get_u16(buf, 7)) return;
+
+    // Whatever it is, the other side needs to hear about it. Even a
+    // duplicate means our last ack may have been lost.
+    ack_pending_ = true;
+
+    std::int32_t ahead = seq_diff(seq, in_next_);
+    if(ahead < 0)
+    {
+      ++stats_.duplicates;
+      return;
+    }
+    // We have no room for it yet.
+    if(static_cast<std::size_t>(ahead) >= opts_.window) return;
+
+    buf_t& slot = in_window_[seq % opts_.window];
+    if(!slot.empty())
+    {
+      ++stats_.duplicates;
+      return;
+    }
+    slot = buf;
+
+    // Hand over everything that is now in order.
+    while(true)
+    {
+      buf_t& next = in_window_[in_next_ % opts_.window];
+      if(next.empty()) break;
+
+      bool last = get_u16(next, 5) + 1 == get_u16(next, 7);
+      message_.insert(message_.end(), next.begin() + Header_Size, next.end());
+
+      // Clear the slot rather than free it, it will be used again soon.
+      next.clear();
+      ++in_next_;
+
+      if(last)
+      {
+        post(message_);
+        message_.clear();
+      }
+    }
+  }
+
+  void Reliable_IO::on_ack_(buf_t const& buf) noexcept
+  {
+    std::uint32_t next = get_u32(buf, 1);
+    std::uint32_t sack = get_u32(buf, 5);
+
+    // Everything before next made it.
+    while(!out_.empty() && seq_diff(next, out_base_) > 0)
+    {
+      out_.pop_front();
+      ++out_base_;
+    }
+
+    for(std::size_t i = 0; i < Sack_Bits; ++i)
+    {
+      if(!(sack & (std::uint32_t(1) << i))) continue;
+
+      std::uint32_t index = next + 1 + i - out_base_;
+      if(index < out_.size()) out_[index].acked = true;
+    }
+  }
+}
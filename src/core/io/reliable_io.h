@@ -0,0 +1,124 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "external_io.h"
+namespace ug
+{
+  struct Reliable_Options
+  {
+    // Bytes of a message that go in one datagram, bigger messages are split
+    // up. Keep the whole datagram under the path MTU.
+    std::size_t max_payload = 1200;
+    // Datagrams that may be in flight at once.
+    std::size_t window = 256;
+    // How long to wait for an ack before sending again, this doubles with
+    // every retry of the same datagram.
+    std::chrono::milliseconds retransmit_timeout{50};
+  };
+
+  struct Reliable_Stats
+  {
+    std::size_t datagrams_sent = 0;
+    std::size_t retransmits = 0;
+    std::size_t acks_sent = 0;
+    // Received datagrams we already had.
+    std::size_t duplicates = 0;
+  };
+
+  /*!
+   * \brief Ordered, reliable messages over an io that may lose, duplicate or
+   * reorder datagrams, like Net_IO.
+   *
+   * Every write is posted once and in order on the other side, no matter its
+   * size. Each datagram carries a sequence number and is sent again until
+   * the other side acknowledges it, either directly or with a cumulative
+   * ack. Datagrams that arrive early are held on to rather than dropped, so
+   * one loss doesn't stall everything behind it.
+   *
+   * Acks and retransmits go out from step(), which needs to be called
+   * regularly even if the underlying io is serviced by an IO_Context.
+   */
+  struct Reliable_IO : public External_IO
+  {
+    explicit Reliable_IO(std::unique_ptr<External_IO> io,
+                         Reliable_Options opts = Reliable_Options{}) noexcept;
+
+    void write(buf_t const& buf) noexcept override;
+    void step() noexcept override;
+
+    inline Reliable_Stats const& stats() const noexcept;
+
+    // Whether everything written so far was acknowledged.
+    inline bool idle() const noexcept;
+  private:
+    using clock_t = std::chrono::steady_clock;
+
+    struct Out_Datagram
+    {
+      buf_t data;
+      bool sent = false;
+      bool acked = false;
+      clock_t::time_point sent_at;
+      unsigned int retries = 0;
+    };
+
+    void on_datagram_(buf_t const& buf) noexcept;
+    void on_data_(buf_t const& buf) noexcept;
+    void on_ack_(buf_t const& buf) noexcept;
+
+    void send_ack_() noexcept;
+    void send_datagrams_() noexcept;
+
+    std::unique_ptr<External_IO> io_;
+    Reliable_Options opts_;
+    Reliable_Stats stats_;
+
+    // Sequence number of out_.front().
+    std::uint32_t out_base_ = 0;
+    // Every datagram that wasn't acknowledged yet, in order.
+    std::deque<Out_Datagram> out_;
+
+    // Sequence number we are waiting for.
+    std::uint32_t in_next_ = 0;
+    // Datagrams that came early, indexed by sequence number modulo the
+    // window. Empty slots haven't been received.
+    std::vector<buf_t> in_window_;
+    // Fragments of the message being put back together.
+    buf_t message_;
+    bool ack_pending_ = false;
+
+    // Reused for every datagram we send.
+    buf_t datagram_buf_;
+  };
+
+  inline Reliable_Stats const& Reliable_IO::stats() const noexcept
+  {
+    return stats_;
+  }
+  inline bool Reliable_IO::idle() const noexcept
+  {
+    return out_.empty();
+  }
+}
@@ -0,0 +1,275 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "shm.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+namespace ug { namespace shm
+{
+  namespace
+  {
+    // Each ring header gets a page to itself, which keeps the data after it
+    // page aligned.
+    constexpr std::size_t Header_Size = 4096;
+
+    std::size_t ring_capacity(std::size_t capacity) noexcept
+    {
+      std::size_t ret = Header_Size;
+      while(ret < capacity) ret *= 2;
+      return ret;
+    }
+
+    void close_fds(Channel_Fds const& fds) noexcept
+    {
+      if(fds.mem_fd >= 0) close(fds.mem_fd);
+      if(fds.host_event_fd >= 0) close(fds.host_event_fd);
+      if(fds.plugin_event_fd >= 0) close(fds.plugin_event_fd);
+    }
+
+    void signal(int fd) noexcept
+    {
+      std::uint64_t one = 1;
+      // This can only fail if the counter would overflow, in which case the
+      // peer has plenty of wake ups waiting for it anyway.
+      if(::write(fd, &one, sizeof(one))) {}
+    }
+
+    Ring ring_at(void* mem, std::size_t capacity) noexcept
+    {
+      auto bytes = static_cast<uchar*>(mem);
+      return Ring{reinterpret_cast<Ring_Header*>(bytes),
+                  bytes + Header_Size, capacity};
+    }
+
+    // The peer can write anything to the header, so positions are checked
+    // before they are used to index the ring.
+    bool sane(Ring const& r, std::uint64_t head, std::uint64_t tail) noexcept
+    {
+      return tail - head <= r.capacity;
+    }
+
+    std::size_t push(Ring& r, uchar const* data, std::size_t size,
+                     bool& was_empty, bool& broken) noexcept
+    {
+      // Only we write the tail.
+      auto tail = r.header->tail.load(std::memory_order_relaxed);
+      auto head = r.header->head.load(std::memory_order_acquire);
+      if(!sane(r, head, tail))
+      {
+        broken = true;
+        return 0;
+      }
+
+      size = std::min<std::size_t>(size, r.capacity - (tail - head));
+      if(!size) return 0;
+
+      std::size_t start = tail & (r.capacity - 1);
+      std::size_t first = std::min(size, r.capacity - start);
+      std::memcpy(r.data + start, data, first);
+      std::memcpy(r.data, data + first, size - first);
+
+      // Publish the data then check whether the consumer had already caught
+      // up with us. Both are sequentially consistent so that a consumer going
+      // to sleep either sees our data or we see it caught up and wake it.
+      r.header->tail.store(tail + size);
+      was_empty = r.header->head.load() == tail;
+      return size;
+    }
+
+    std::size_t pop(Ring& r, buf_t& buf, bool& broken) noexcept
+    {
+      auto head = r.header->head.load(std::memory_order_relaxed);
+      auto tail = r.header->tail.load(std::memory_order_acquire);
+      if(!sane(r, head, tail))
+      {
+        broken = true;
+        return 0;
+      }
+
+      std::size_t size = tail - head;
+      if(!size) return 0;
+
+      std::size_t start = head & (r.capacity - 1);
+      std::size_t first = std::min(size, r.capacity - start);
+      buf.insert(buf.end(), r.data + start, r.data + start + first);
+      buf.insert(buf.end(), r.data, r.data + size - first);
+
+      r.header->head.store(tail);
+      return size;
+    }
+
+    Channel* map_channel(Channel_Fds const& fds, Side side)
+    {
+      std::size_t ring_size = Header_Size + fds.capacity;
+      std::size_t mem_size = ring_size * 2;
+
+      void* mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fds.mem_fd, 0);
+      if(mem == MAP_FAILED)
+      {
+        int err = errno;
+        close_fds(fds);
+        throw Create_Error{err};
+      }
+
+      Channel* self = new Channel;
+      self->fds = fds;
+      self->side = side;
+      self->mem = mem;
+      self->mem_size = mem_size;
+      self->broken = false;
+
+      Ring host_ring = ring_at(mem, fds.capacity);
+      Ring plugin_ring = ring_at(static_cast<uchar*>(mem) + ring_size,
+                                 fds.capacity);
+
+      if(side == Side::Host)
+      {
+        self->tx = host_ring;
+        self->rx = plugin_ring;
+        self->wake_fd = fds.plugin_event_fd;
+        self->wait_fd = fds.host_event_fd;
+      }
+      else
+      {
+        self->tx = plugin_ring;
+        self->rx = host_ring;
+        self->wake_fd = fds.host_event_fd;
+        self->wait_fd = fds.plugin_event_fd;
+      }
+      return self;
+    }
+  }
+
+  Channel* create_channel(std::size_t capacity)
+  {
+    Channel_Fds fds{-1, -1, -1, ring_capacity(capacity)};
+
+    // The descriptors are left inheritable on purpose, see Channel_Fds.
+    fds.mem_fd = memfd_create("uglue-shm", 0);
+    fds.host_event_fd = eventfd(0, EFD_NONBLOCK);
+    fds.plugin_event_fd = eventfd(0, EFD_NONBLOCK);
+    if(fds.mem_fd < 0 || fds.host_event_fd < 0 || fds.plugin_event_fd < 0)
+    {
+      int err = errno;
+      close_fds(fds);
+      throw Create_Error{err};
+    }
+
+    // A new memfd reads as zeros, which is exactly the state of an empty
+    // ring.
+    if(ftruncate(fds.mem_fd, (Header_Size + fds.capacity) * 2))
+    {
+      int err = errno;
+      close_fds(fds);
+      throw Create_Error{err};
+    }
+
+    return map_channel(fds, Side::Host);
+  }
+  Channel* open_channel(Channel_Fds const& fds)
+  {
+    if(fds.capacity != ring_capacity(fds.capacity))
+    {
+      close_fds(fds);
+      throw Create_Error{EINVAL};
+    }
+    return map_channel(fds, Side::Plugin);
+  }
+  void delete_channel(Channel* self) noexcept
+  {
+    munmap(self->mem, self->mem_size);
+    close_fds(self->fds);
+    delete self;
+  }
+
+  std::size_t write(Channel& c, uchar const* data, std::size_t size) noexcept
+  {
+    if(c.broken) return 0;
+
+    bool was_empty = false;
+    std::size_t written = push(c.tx, data, size, was_empty, c.broken);
+    if(written < size && !c.broken)
+    {
+      // Ask to be woken up once there's room then try again, in case the
+      // consumer made some before it could see our request. push() only
+      // loads the head with acquire, which could be done before our store
+      // is visible. The fence pairs with the one in read(): either we see
+      // the consumer's room or it sees us waiting.
+      c.tx.header->producer_waiting.store(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool more_was_empty = false;
+      written += push(c.tx, data + written, size - written, more_was_empty,
+                      c.broken);
+      was_empty = was_empty || more_was_empty;
+    }
+    if(was_empty) signal(c.wake_fd);
+    return written;
+  }
+  std::size_t read(Channel& c, buf_t& buf) noexcept
+  {
+    if(c.broken) return 0;
+
+    std::size_t size = pop(c.rx, buf, c.broken);
+    if(!size) return 0;
+
+    // Our new head has to be visible before we look for a waiting producer,
+    // see write().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(c.rx.header->producer_waiting.load())
+    {
+      c.rx.header->producer_waiting.store(0);
+      signal(c.wake_fd);
+    }
+    return size;
+  }
+  bool readable(Channel const& c) noexcept
+  {
+    if(c.broken) return false;
+    return c.rx.header->head.load(std::memory_order_relaxed) !=
+           c.rx.header->tail.load();
+  }
+  bool wait(Channel& c, int timeout) noexcept
+  {
+    if(c.broken) return false;
+    if(readable(c)) return true;
+
+    pollfd fd;
+    fd.fd = c.wait_fd;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    if(poll(&fd, 1, timeout) <= 0) return false;
+
+    // We'll check the rings ourselves.
+    clear_wake_ups(c);
+    return true;
+  }
+  void clear_wake_ups(Channel& c) noexcept
+  {
+    // Reading an eventfd resets its counter.
+    std::uint64_t count;
+    if(::read(c.wait_fd, &count, sizeof(count))) {}
+  }
+} }
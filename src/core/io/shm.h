@@ -0,0 +1,172 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "buffer.h"
+
+namespace ug { namespace shm
+{
+  // Exceptions
+  struct Create_Error
+  {
+    // errno of the call that failed.
+    int err;
+  };
+
+  /*!
+   * \brief Lives at the start of each ring in shared memory.
+   *
+   * Positions only ever grow, they are masked with the capacity to index into
+   * the ring. Each one is written by a single side and gets its own cache
+   * line so the two processes don't fight over it.
+   */
+  struct Ring_Header
+  {
+    // Bytes read so far, written by the consumer.
+    alignas(64) std::atomic<std::uint64_t> head;
+    // Bytes written so far, written by the producer.
+    alignas(64) std::atomic<std::uint64_t> tail;
+    // Set by a producer that ran out of room and wants to be woken up.
+    alignas(64) std::atomic<std::uint32_t> producer_waiting;
+  };
+
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+                "Shared memory rings need lock-free 64-bit atomics");
+
+  /*!
+   * \brief Single-producer single-consumer byte ring.
+   */
+  struct Ring
+  {
+    Ring_Header* header;
+    uchar* data;
+    // Always a power of two.
+    std::size_t capacity;
+  };
+
+  /*!
+   * \brief Everything another process needs to attach to a channel.
+   *
+   * The descriptors are inheritable, so a child process can be handed them
+   * on its command line.
+   */
+  struct Channel_Fds
+  {
+    // memfd holding both rings.
+    int mem_fd;
+    // eventfd the host waits on.
+    int host_event_fd;
+    // eventfd the plugin waits on.
+    int plugin_event_fd;
+    // Capacity of each ring.
+    std::size_t capacity;
+  };
+
+  enum class Side
+  {
+    Host, Plugin
+  };
+
+  /*!
+   * \brief Two rings, one for each direction, and a way to wake the peer.
+   *
+   * The host writes to the first ring and reads from the second, the plugin
+   * does the opposite.
+   */
+  struct Channel
+  {
+    Channel_Fds fds;
+    Side side;
+
+    void* mem;
+    std::size_t mem_size;
+
+    Ring tx;
+    Ring rx;
+
+    // eventfd we signal to wake the peer up.
+    int wake_fd;
+    // eventfd the peer signals to wake us up.
+    int wait_fd;
+
+    // Set once the peer left a ring in a state that makes no sense. Nothing
+    // touches the shared memory after that.
+    bool broken;
+  };
+
+  /*!
+   * \brief Creates a new channel with rings of at least the given capacity.
+   *
+   * \throws Create_Error
+   */
+  Channel* create_channel(std::size_t capacity);
+
+  /*!
+   * \brief Maps a channel created by another process.
+   *
+   * Takes ownership of the descriptors.
+   *
+   * \throws Create_Error
+   */
+  Channel* open_channel(Channel_Fds const& fds);
+
+  void delete_channel(Channel*) noexcept;
+
+  /*!
+   * \brief Copies as much of the data as fits into the ring going to the peer.
+   *
+   * The peer is only woken up if it may have run out of things to read.
+   * Writes nothing once the channel is broken.
+   *
+   * \returns The amount of bytes written.
+   */
+  std::size_t write(Channel& c, uchar const* data, std::size_t size) noexcept;
+
+  /*!
+   * \brief Appends everything the peer wrote so far to the buffer.
+   *
+   * Reads nothing once the channel is broken.
+   *
+   * \returns The amount of bytes read.
+   */
+  std::size_t read(Channel& c, buf_t& buf) noexcept;
+
+  /*!
+   * \brief Whether there is anything to read.
+   */
+  bool readable(Channel const& c) noexcept;
+
+  /*!
+   * \brief Forgets about pending wake ups, for use when polling wait_fd.
+   */
+  void clear_wake_ups(Channel& c) noexcept;
+
+  /*!
+   * \brief Blocks until the peer writes something or makes room for us.
+   *
+   * Returns immediately if there is already something to read.
+   *
+   * \param timeout Milliseconds to wait for, negative to wait forever.
+   * \returns False on timeout.
+   */
+  bool wait(Channel& c, int timeout) noexcept;
+} }
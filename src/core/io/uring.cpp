@@ -0,0 +1,730 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "uring.h"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#ifdef UG_HAVE_IO_URING
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <sys/uio.h>
+  #include <unistd.h>
+#endif
+namespace ug { namespace uring
+{
+  Op* create_op(void* user_data, complete_cb cb) noexcept
+  {
+    Op* op = new Op;
+    op->user_data = user_data;
+    op->cb = cb;
+    return op;
+  }
+
+#ifdef UG_HAVE_IO_URING
+  namespace
+  {
+    // Writes that fit are copied to one of these. They are registered with
+    // the kernel, so it doesn't have to map their pages for every write.
+    constexpr unsigned int Write_Slots = 16;
+    constexpr std::size_t Slot_Size = 16 * 1024;
+
+    // Multishot receives pick one of these for every chunk. The count must
+    // be a power of two.
+    constexpr unsigned int Recv_Buffers = 32;
+    constexpr std::size_t Recv_Buffer_Size = 16 * 1024;
+    constexpr uint16_t Recv_Group = 0;
+
+    int sys_setup(unsigned int entries, io_uring_params* p) noexcept
+    {
+      return (int) syscall(__NR_io_uring_setup, entries, p);
+    }
+    int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                  unsigned int flags) noexcept
+    {
+      return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                           flags, nullptr, 0);
+    }
+    int sys_register(int fd, unsigned int opcode, void const* arg,
+                     unsigned int nr_args) noexcept
+    {
+      return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    void* map_anon(std::size_t size) noexcept
+    {
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return mem == MAP_FAILED ? nullptr : mem;
+    }
+
+    // What the running kernel can do, found out once.
+    struct Support
+    {
+      // Every op Uring_IO can't do without.
+      bool ring = false;
+      // Multishot receives, sockets are read with plain reads without them.
+      bool recv = false;
+    };
+
+    bool supported(io_uring_probe const* p, int opcode) noexcept
+    {
+      return opcode <= p->last_op &&
+             (p->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    Support probe() noexcept
+    {
+      Support support;
+
+      io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      int fd = sys_setup(4, &params);
+      if(fd < 0) return support;
+
+      constexpr unsigned int Probe_Ops = 64;
+      std::vector<uchar> mem(sizeof(io_uring_probe) +
+                             Probe_Ops * sizeof(io_uring_probe_op));
+      io_uring_probe* p = (io_uring_probe*) mem.data();
+      bool ok = sys_register(fd, IORING_REGISTER_PROBE, p, Probe_Ops) == 0;
+      close(fd);
+      if(!ok) return support;
+
+      for(int opcode : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+                        IORING_OP_ASYNC_CANCEL})
+      {
+        if(!supported(p, opcode)) return support;
+      }
+      support.ring = true;
+      support.recv = supported(p, IORING_OP_RECV);
+      return support;
+    }
+    Support const& support() noexcept
+    {
+      static Support const support = probe();
+      return support;
+    }
+  }
+
+  struct Ring
+  {
+    int fd;
+
+    void* sq_map;
+    std::size_t sq_map_size;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_flags;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    io_uring_sqe* sqes;
+    std::size_t sqes_size;
+    // Tail of what we have filled in, the kernel sees it on submit.
+    unsigned int sq_local_tail;
+
+    void* cq_map;
+    std::size_t cq_map_size;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    io_uring_cqe* cqes;
+
+    // Registered write buffers, null if the kernel wouldn't take them.
+    uchar* slots;
+    std::vector<int> free_slots;
+
+    // Buffers for multishot receives, null if they aren't supported.
+    io_uring_buf_ring* recv_ring;
+    uchar* recv_bufs;
+    uint16_t recv_tail;
+
+    std::size_t ops_in_flight;
+    // Writes to continue once there's room in the submission queue.
+    std::vector<Op*> retries;
+    // Nothing goes to the kernel while this is set.
+    bool held;
+    Ring_Stats stats;
+
+    uv_poll_t poll;
+    uv_prepare_t prepare;
+    // Handles delete_ring is still waiting on.
+    int open_handles;
+  };
+
+  namespace
+  {
+    // Hands what's queued to the kernel, retries are left alone.
+    void enter(Ring& r) noexcept
+    {
+      if(r.held) return;
+
+      __atomic_store_n(r.sq_tail, r.sq_local_tail, __ATOMIC_RELEASE);
+      unsigned int to_submit =
+        r.sq_local_tail - __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE);
+      if(!to_submit) return;
+
+      ++r.stats.enters;
+      int submitted = sys_enter(r.fd, to_submit, 0, 0);
+      if(submitted > 0) r.stats.submitted += submitted;
+    }
+
+    io_uring_sqe* get_sqe(Ring& r) noexcept
+    {
+      unsigned int head = __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE);
+      if(r.sq_local_tail - head >= r.sq_entries)
+      {
+        // Make room by handing what's there to the kernel now.
+        enter(r);
+        head = __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE);
+        if(r.sq_local_tail - head >= r.sq_entries) return nullptr;
+      }
+      io_uring_sqe* sqe = &r.sqes[r.sq_local_tail & r.sq_mask];
+      std::memset(sqe, 0, sizeof(*sqe));
+      ++r.sq_local_tail;
+      return sqe;
+    }
+
+    void start_op(Ring& r, Op& op, io_uring_sqe* sqe) noexcept
+    {
+      sqe->user_data = (uint64_t) &op;
+      if(!op.in_flight) ++r.ops_in_flight;
+      op.in_flight = true;
+    }
+
+    bool queue_write(Ring& r, Op& op) noexcept
+    {
+      io_uring_sqe* sqe = get_sqe(r);
+      if(!sqe) return false;
+
+      sqe->fd = op.fd;
+      sqe->off = (uint64_t) -1;
+      sqe->addr = (uint64_t) op.data;
+      sqe->len = op.size;
+      if(op.slot >= 0)
+      {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = op.slot;
+      }
+      else
+      {
+        sqe->opcode = IORING_OP_WRITE;
+      }
+      start_op(r, op, sqe);
+      return true;
+    }
+
+    // The kernel is done with the op.
+    void finish_op(Ring& r, Op& op) noexcept
+    {
+      op.in_flight = false;
+      --r.ops_in_flight;
+      if(op.slot >= 0) r.free_slots.push_back(op.slot);
+      op.slot = -1;
+      op.data = nullptr;
+      op.size = 0;
+    }
+
+    // Continues the writes that didn't fit before, in order.
+    void retry_writes(Ring& r) noexcept
+    {
+      std::size_t done = 0;
+      for(; done < r.retries.size(); ++done)
+      {
+        Op* op = r.retries[done];
+        if(op->orphaned)
+        {
+          finish_op(r, *op);
+          delete op;
+          continue;
+        }
+        if(!queue_write(r, *op)) break;
+      }
+      r.retries.erase(r.retries.begin(), r.retries.begin() + done);
+    }
+
+    uchar* recv_buffer(Ring& r, uint16_t bid) noexcept
+    {
+      return r.recv_bufs + bid * Recv_Buffer_Size;
+    }
+    void give_recv_buffer(Ring& r, uint16_t bid) noexcept
+    {
+      // io_uring_buf_ring::bufs is off by the size of an empty struct in
+      // C++, but the entries really start with the ring.
+      io_uring_buf* bufs = (io_uring_buf*) r.recv_ring;
+      io_uring_buf* buf = &bufs[r.recv_tail & (Recv_Buffers - 1)];
+      buf->addr = (uint64_t) recv_buffer(r, bid);
+      buf->len = Recv_Buffer_Size;
+      buf->bid = bid;
+      ++r.recv_tail;
+      __atomic_store_n(&r.recv_ring->tail, r.recv_tail, __ATOMIC_RELEASE);
+    }
+
+    void complete(Ring& r, io_uring_cqe const& cqe) noexcept
+    {
+      Op* op = (Op*) cqe.user_data;
+      // Cancel requests don't belong to anybody.
+      if(!op) return;
+
+      ++r.stats.completed;
+
+      // Only writes keep track of their data.
+      bool writing = op->data;
+
+      // Finish short writes before telling anyone.
+      if(writing && cqe.res > 0 && (std::size_t) cqe.res < op->size &&
+         !op->orphaned)
+      {
+        op->data += cqe.res;
+        op->size -= cqe.res;
+        // Still in flight as far as the owner can tell, the rest goes with
+        // the next submit if the queue is full.
+        if(!queue_write(r, *op)) r.retries.push_back(op);
+        return;
+      }
+
+      bool more = cqe.flags & IORING_CQE_F_MORE;
+      if(!more) finish_op(r, *op);
+
+      Buf_View read;
+      bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+      uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      if(has_buffer && cqe.res > 0)
+      {
+        read = Buf_View{recv_buffer(r, bid), (std::size_t) cqe.res};
+      }
+      else if(!writing && !has_buffer && cqe.res > 0)
+      {
+        read = Buf_View{op->buf.data(), (std::size_t) cqe.res};
+      }
+
+      if(op->orphaned)
+      {
+        if(!more) delete op;
+      }
+      else
+      {
+        op->cb(op, cqe.res, read);
+      }
+
+      // Whoever got the data is done with it.
+      if(has_buffer) give_recv_buffer(r, bid);
+    }
+
+    void reap(Ring& r) noexcept
+    {
+      unsigned int head = *r.cq_head;
+      while(true)
+      {
+        unsigned int tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        if(head == tail)
+        {
+          // Completions that didn't fit are only moved over on request.
+          if(!(__atomic_load_n(r.sq_flags, __ATOMIC_RELAXED) &
+               IORING_SQ_CQ_OVERFLOW)) break;
+          sys_enter(r.fd, 0, 0, IORING_ENTER_GETEVENTS);
+          ++r.stats.enters;
+          if(head == __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) break;
+          continue;
+        }
+
+        io_uring_cqe cqe = r.cqes[head & r.cq_mask];
+        ++head;
+        // Give the entry back before anything we call queues more work.
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+        complete(r, cqe);
+      }
+    }
+
+    void on_ready(uv_poll_t* poll, int, int) noexcept
+    {
+      reap(*(Ring*) poll->data);
+    }
+    void on_prepare(uv_prepare_t* prepare) noexcept
+    {
+      submit(*(Ring*) prepare->data);
+    }
+
+    bool map_queues(Ring& r, io_uring_params const& p) noexcept
+    {
+      r.sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+      r.cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      if(p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+        if(r.cq_map_size > r.sq_map_size) r.sq_map_size = r.cq_map_size;
+        r.cq_map_size = r.sq_map_size;
+      }
+
+      r.sq_map = mmap(nullptr, r.sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+      if(r.sq_map == MAP_FAILED) return false;
+
+      if(p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+        r.cq_map = r.sq_map;
+      }
+      else
+      {
+        r.cq_map = mmap(nullptr, r.cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+        if(r.cq_map == MAP_FAILED)
+        {
+          munmap(r.sq_map, r.sq_map_size);
+          return false;
+        }
+      }
+
+      r.sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+      void* sqes = mmap(nullptr, r.sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+      if(sqes == MAP_FAILED)
+      {
+        if(r.cq_map != r.sq_map) munmap(r.cq_map, r.cq_map_size);
+        munmap(r.sq_map, r.sq_map_size);
+        return false;
+      }
+      r.sqes = (io_uring_sqe*) sqes;
+
+      char* sq = (char*) r.sq_map;
+      r.sq_head = (unsigned int*) (sq + p.sq_off.head);
+      r.sq_tail = (unsigned int*) (sq + p.sq_off.tail);
+      r.sq_flags = (unsigned int*) (sq + p.sq_off.flags);
+      r.sq_mask = *(unsigned int*) (sq + p.sq_off.ring_mask);
+      r.sq_entries = p.sq_entries;
+      r.sq_local_tail = *r.sq_tail;
+
+      // Entries are always used in order.
+      unsigned int* array = (unsigned int*) (sq + p.sq_off.array);
+      for(unsigned int i = 0; i < p.sq_entries; ++i) array[i] = i;
+
+      char* cq = (char*) r.cq_map;
+      r.cq_head = (unsigned int*) (cq + p.cq_off.head);
+      r.cq_tail = (unsigned int*) (cq + p.cq_off.tail);
+      r.cq_mask = *(unsigned int*) (cq + p.cq_off.ring_mask);
+      r.cqes = (io_uring_cqe*) (cq + p.cq_off.cqes);
+      return true;
+    }
+
+    void register_slots(Ring& r) noexcept
+    {
+      r.slots = (uchar*) map_anon(Write_Slots * Slot_Size);
+      if(!r.slots) return;
+
+      iovec iovs[Write_Slots];
+      for(unsigned int i = 0; i < Write_Slots; ++i)
+      {
+        iovs[i].iov_base = r.slots + i * Slot_Size;
+        iovs[i].iov_len = Slot_Size;
+      }
+      // Usually this fails because of the memlock limit, plain writes do.
+      if(sys_register(r.fd, IORING_REGISTER_BUFFERS, iovs, Write_Slots))
+      {
+        munmap(r.slots, Write_Slots * Slot_Size);
+        r.slots = nullptr;
+        return;
+      }
+      for(int i = Write_Slots - 1; i >= 0; --i) r.free_slots.push_back(i);
+    }
+
+    void register_recv_buffers(Ring& r) noexcept
+    {
+      if(!support().recv)
+      {
+        r.recv_ring = nullptr;
+        r.recv_bufs = nullptr;
+        return;
+      }
+
+      r.recv_ring = (io_uring_buf_ring*)
+        map_anon(Recv_Buffers * sizeof(io_uring_buf));
+      r.recv_bufs = (uchar*) map_anon(Recv_Buffers * Recv_Buffer_Size);
+      r.recv_tail = 0;
+
+      io_uring_buf_reg reg;
+      std::memset(&reg, 0, sizeof(reg));
+      reg.ring_addr = (uint64_t) r.recv_ring;
+      reg.ring_entries = Recv_Buffers;
+      reg.bgid = Recv_Group;
+
+      // Older kernels don't know about buffer rings.
+      if(!r.recv_ring || !r.recv_bufs ||
+         sys_register(r.fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+      {
+        if(r.recv_ring) munmap(r.recv_ring, Recv_Buffers*sizeof(io_uring_buf));
+        if(r.recv_bufs) munmap(r.recv_bufs, Recv_Buffers * Recv_Buffer_Size);
+        r.recv_ring = nullptr;
+        r.recv_bufs = nullptr;
+        return;
+      }
+      for(uint16_t bid = 0; bid < Recv_Buffers; ++bid)
+      {
+        give_recv_buffer(r, bid);
+      }
+
+    }
+  }
+
+  bool available() noexcept
+  {
+    return support().ring;
+  }
+
+  Ring* create_ring(uv_loop_t* loop, unsigned int entries)
+  {
+    if(!available()) throw Setup_Error{ENOSYS};
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = sys_setup(entries, &params);
+    if(fd < 0) throw Setup_Error{errno};
+
+    Ring* r = new Ring;
+    r->fd = fd;
+    if(!map_queues(*r, params))
+    {
+      int err = errno;
+      close(fd);
+      delete r;
+      throw Setup_Error{err};
+    }
+    register_slots(*r);
+    register_recv_buffers(*r);
+    r->ops_in_flight = 0;
+    r->held = false;
+
+    r->poll.data = r;
+    uv_poll_init(loop, &r->poll, fd);
+    uv_poll_start(&r->poll, UV_READABLE, on_ready);
+
+    // Runs once every iteration right before the loop polls, it shouldn't
+    // keep it alive by itself.
+    r->prepare.data = r;
+    uv_prepare_init(loop, &r->prepare);
+    uv_prepare_start(&r->prepare, on_prepare);
+    uv_unref((uv_handle_t*) &r->prepare);
+
+    r->open_handles = 2;
+    return r;
+  }
+  void delete_ring(Ring* r) noexcept
+  {
+    uv_poll_stop(&r->poll);
+    uv_prepare_stop(&r->prepare);
+    r->held = false;
+
+    // Writes that never made it back to the kernel are over now.
+    for(Op* op : r->retries)
+    {
+      finish_op(*r, *op);
+      if(op->orphaned) delete op;
+      else op->cb(op, -ECANCELED, Buf_View{});
+    }
+    r->retries.clear();
+
+    // Released ops were canceled already, this catches any whose cancel
+    // didn't fit in the queue. Then the kernel has to be done with them.
+    if(r->ops_in_flight)
+    {
+      if(io_uring_sqe* sqe = get_sqe(*r))
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+      }
+    }
+    submit(*r);
+    while(r->ops_in_flight)
+    {
+      ++r->stats.enters;
+      if(sys_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+         errno != EINTR) break;
+      reap(*r);
+    }
+
+    // Stop watching the fd while it's still open.
+    auto on_close = [](uv_handle_t* h)
+    {
+      Ring* r = (Ring*) h->data;
+      if(--r->open_handles == 0) delete r;
+    };
+    uv_close((uv_handle_t*) &r->poll, on_close);
+    uv_close((uv_handle_t*) &r->prepare, on_close);
+
+    munmap(r->sqes, r->sqes_size);
+    if(r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    munmap(r->sq_map, r->sq_map_size);
+    // Closing the ring unregisters the buffers.
+    close(r->fd);
+    if(r->slots) munmap(r->slots, Write_Slots * Slot_Size);
+    if(r->recv_ring)
+    {
+      munmap(r->recv_ring, Recv_Buffers * sizeof(io_uring_buf));
+      munmap(r->recv_bufs, Recv_Buffers * Recv_Buffer_Size);
+    }
+  }
+
+  Ring_Stats const& stats(Ring const& r) noexcept
+  {
+    return r.stats;
+  }
+  bool has_multishot(Ring const& r) noexcept
+  {
+    return r.recv_ring;
+  }
+
+  void release_op(Ring& r, Op* op) noexcept
+  {
+    if(!op->in_flight)
+    {
+      delete op;
+      return;
+    }
+
+    op->orphaned = true;
+    io_uring_sqe* sqe = get_sqe(r);
+    if(!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t) op;
+  }
+
+  bool write(Ring& r, Op& op, int fd, buf_t&& data) noexcept
+  {
+    op.fd = fd;
+    op.multishot = false;
+    op.size = data.size();
+    if(!r.free_slots.empty() && data.size() <= Slot_Size)
+    {
+      op.slot = r.free_slots.back();
+      op.data = r.slots + op.slot * Slot_Size;
+      std::memcpy((uchar*) op.data, data.data(), data.size());
+    }
+    else
+    {
+      op.slot = -1;
+      op.buf = std::move(data);
+      op.data = op.buf.data();
+    }
+
+    if(!queue_write(r, op))
+    {
+      // Give the data back.
+      if(op.slot < 0) data = std::move(op.buf);
+      op.slot = -1;
+      op.data = nullptr;
+      return false;
+    }
+    if(op.slot >= 0) r.free_slots.pop_back();
+    return true;
+  }
+
+  bool read(Ring& r, Op& op, int fd, std::size_t size) noexcept
+  {
+    io_uring_sqe* sqe = get_sqe(r);
+    if(!sqe) return false;
+
+    op.fd = fd;
+    op.multishot = false;
+    op.data = nullptr;
+    op.buf.resize(size);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = (uint64_t) -1;
+    sqe->addr = (uint64_t) op.buf.data();
+    sqe->len = size;
+    start_op(r, op, sqe);
+    return true;
+  }
+
+  bool recv_multishot(Ring& r, Op& op, int fd) noexcept
+  {
+    if(!r.recv_ring) return false;
+
+    io_uring_sqe* sqe = get_sqe(r);
+    if(!sqe) return false;
+
+    op.fd = fd;
+    op.multishot = true;
+    op.data = nullptr;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Recv_Group;
+    start_op(r, op, sqe);
+    return true;
+  }
+
+  void submit(Ring& r) noexcept
+  {
+    if(r.held) return;
+    retry_writes(r);
+    enter(r);
+  }
+  void hold_submissions(Ring& r, bool hold) noexcept
+  {
+    r.held = hold;
+  }
+#else
+  // Built without io_uring, nothing can ever get a ring.
+  struct Ring
+  {
+    Ring_Stats stats;
+  };
+
+  bool available() noexcept
+  {
+    return false;
+  }
+  Ring* create_ring(uv_loop_t*, unsigned int)
+  {
+    throw Setup_Error{ENOSYS};
+  }
+  void delete_ring(Ring* r) noexcept
+  {
+    delete r;
+  }
+  Ring_Stats const& stats(Ring const& r) noexcept
+  {
+    return r.stats;
+  }
+  bool has_multishot(Ring const&) noexcept
+  {
+    return false;
+  }
+  void release_op(Ring&, Op* op) noexcept
+  {
+    delete op;
+  }
+  bool write(Ring&, Op&, int, buf_t&&) noexcept
+  {
+    return false;
+  }
+  bool read(Ring&, Op&, int, std::size_t) noexcept
+  {
+    return false;
+  }
+  bool recv_multishot(Ring&, Op&, int) noexcept
+  {
+    return false;
+  }
+  void submit(Ring&) noexcept {}
+  void hold_submissions(Ring&, bool) noexcept {}
+#endif
+} }
@@ -0,0 +1,146 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <uv.h>
+#include <cstdint>
+#include <cstddef>
+#include "buffer.h"
+
+namespace ug { namespace uring
+{
+  // Exceptions
+  struct Setup_Error
+  {
+    // errno of the call that failed, ENOSYS if we were built without it.
+    int err;
+  };
+
+  // Whether io_uring can be used on this machine, only checked once.
+  bool available() noexcept;
+
+  /*!
+   * \brief An io_uring serviced by a libuv loop.
+   *
+   * Requests are only queued by the functions below. Everything queued
+   * during a loop iteration goes to the kernel in one io_uring_enter right
+   * before the loop polls, completions are reaped when the ring's fd becomes
+   * readable.
+   */
+  struct Ring;
+
+  struct Op;
+
+  /*!
+   * \brief Called with every completion of an op.
+   *
+   * Reads pass what was read, it's only valid until this returns. Once the
+   * op is done in_flight is false, a multishot receive stays armed until
+   * then.
+   */
+  using complete_cb = void (*)(Op* op, int res, Buf_View read);
+
+  /*!
+   * \brief A request the ring may be working on.
+   *
+   * Everything the kernel could touch belongs to the op, so an owner that
+   * goes away while it's in flight releases it with release_op and the ring
+   * frees it once the kernel is done.
+   */
+  struct Op
+  {
+    void* user_data;
+    complete_cb cb;
+
+    // Set by the ring.
+    bool in_flight = false;
+    bool orphaned = false;
+
+    // The rest of the write in progress.
+    int fd = -1;
+    uchar const* data = nullptr;
+    std::size_t size = 0;
+    // Registered buffer a write was copied to, or -1.
+    int slot = -1;
+    // Writes too big for a slot and single reads are done from here.
+    buf_t buf;
+    bool multishot = false;
+  };
+
+  Op* create_op(void* user_data, complete_cb cb) noexcept;
+  // Cancels the op if the kernel is still working on it.
+  void release_op(Ring&, Op*) noexcept;
+
+  struct Ring_Stats
+  {
+    // io_uring_enter calls, however many requests each one submitted.
+    std::size_t enters = 0;
+    std::size_t submitted = 0;
+    std::size_t completed = 0;
+  };
+
+  // \throws Setup_Error
+  Ring* create_ring(uv_loop_t* loop, unsigned int entries = 256);
+
+  /*!
+   * \brief Cancels whatever is left and waits for the kernel to let go of
+   * our memory.
+   *
+   * Like delete_pipe, the ring is freed on a later run of the loop.
+   */
+  void delete_ring(Ring*) noexcept;
+
+  Ring_Stats const& stats(Ring const&) noexcept;
+
+  // Whether sockets can be read with recv_multishot.
+  bool has_multishot(Ring const&) noexcept;
+
+  /*!
+   * \brief Writes all of data to fd, short writes are continued by the ring.
+   *
+   * The op isn't completed until everything is written or the write fails.
+   * If the rest of a short write doesn't fit in the submission queue it's
+   * queued again with the next submit.
+   * Data that fits in a registered buffer is copied there, otherwise it's
+   * moved into the op. Either way data is consumed when this returns true.
+   * Only one write may be in flight per op.
+   */
+  bool write(Ring&, Op&, int fd, buf_t&& data) noexcept;
+
+  // Reads at most size bytes once.
+  bool read(Ring&, Op&, int fd, std::size_t size) noexcept;
+
+  /*!
+   * \brief Keeps receiving from a socket into buffers picked by the kernel.
+   *
+   * Fails when the ring has no buffers to give, read() will still work.
+   */
+  bool recv_multishot(Ring&, Op&, int fd) noexcept;
+
+  // Sends everything queued so far, the loop does this by itself.
+  void submit(Ring&) noexcept;
+
+  /*!
+   * \brief Keeps everything from the kernel until called with false.
+   *
+   * Requests pile up until the submission queue is full, then fail as if the
+   * kernel couldn't keep up. Only meant for testing that.
+   */
+  void hold_submissions(Ring&, bool hold) noexcept;
+} }
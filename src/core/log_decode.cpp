@@ -0,0 +1,54 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "common/log_binary.h"
+
+// Turns a binary log back into the text the log would have written.
+int main(int argc, char** argv)
+{
+  if(argc > 2)
+  {
+    std::cerr << "usage: " << argv[0] << " [binary log]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Standard input otherwise.
+  std::ifstream file;
+  if(argc == 2)
+  {
+    file.open(argv[1], std::ios::binary);
+    if(!file)
+    {
+      std::cerr << "Failed to open " << argv[1] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::istream& in = argc == 2 ? file : std::cin;
+  if(!ug::decode_binary_log(in, std::cout))
+  {
+    std::cerr << "Not a binary log, or it is cut off" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
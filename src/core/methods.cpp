@@ -32,13 +32,13 @@ namespace engine
 
     using ug::Vec;
 
-    using res_t = ug::response_result;
+    using res_t = ug::response_result<bool>;
 
     dispatch.add_method<Log_Severity, std::string>("Core.Log",
-    [](Log_Severity s, std::string msg) -> res_t
+    [](Log_Severity s, std::string msg)
     {
       log(s, "(Plugin) " + msg);
-      return Json::Value(true);
+      return true;
     });
 
     // Error codes: 1 - Engine already started.
@@ -63,7 +63,7 @@ namespace engine
         return Error_Response{2, "Failed to create window"};
       }
 
-      return Json::Value(true);
+      return true;
     });
 
     // Error code: 3 - engine now started.
@@ -79,21 +79,33 @@ namespace engine
       SDL_DestroyWindow(state.window);
       state.running = false;
 
-      return Json::Value(true);
+      return true;
     });
 
     dispatch.add_method<ug::Color>("Core.Set_Clear_Color",
-    [&state](ug::Color const& c) -> res_t
+    [&state](ug::Color const& c)
     {
       state.clear_color = c;
-      return Json::Value(true);
+      return true;
     });
 
     dispatch.add_method<bool>("Core.Set_Freeze",
-    [&state](bool freeze) -> res_t
+    [&state](bool freeze)
     {
       state.freeze = freeze;
-      return Json::Value(true);
+      return true;
+    });
+
+    // The stats of every plugin, in the order they were started.
+    dispatch.add_method<>("Core.Stats",
+    [&state]()
+    {
+      std::vector<ug::Plugin_Stats> stats;
+      for(ug::Plugin const* plugin : state.plugins)
+      {
+        stats.push_back(plugin->stats());
+      }
+      return stats;
     });
 
     add_widget_methods(dispatch, state);
@@ -0,0 +1,73 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "direct_plugin.h"
+#include <dlfcn.h>
+namespace ug
+{
+  namespace
+  {
+    template <class T>
+    T find_symbol(void* lib, char const* name)
+    {
+      void* sym = dlsym(lib, name);
+      if(!sym)
+      {
+        std::string msg = std::string{"Missing "} + name;
+        dlclose(lib);
+        throw Plugin_Load_Error{msg};
+      }
+      return reinterpret_cast<T>(sym);
+    }
+  }
+
+  Direct_Plugin::Direct_Plugin(std::string const& path,
+                               Req_Dispatcher const& dispatcher)
+  {
+    // Plugins don't get to see each other's symbols.
+    lib_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!lib_) throw Plugin_Load_Error{dlerror()};
+
+    auto abi = find_symbol<int (*)()>(lib_, "ug_plugin_abi");
+    if(abi() != Direct_Plugin_Abi)
+    {
+      dlclose(lib_);
+      throw Plugin_Load_Error{"Plugin built against another engine"};
+    }
+
+    auto start = find_symbol<void* (*)(Direct_Host*)>(lib_,
+                                                       "ug_plugin_start");
+    step_ = find_symbol<void (*)(void*)>(lib_, "ug_plugin_step");
+    stop_ = find_symbol<void (*)(void*)>(lib_, "ug_plugin_stop");
+
+    // The host must stay put, the plugin may hang on to it.
+    host_.dispatcher = &dispatcher;
+    state_ = start(&host_);
+  }
+  Direct_Plugin::~Direct_Plugin() noexcept
+  {
+    stop_(state_);
+    dlclose(lib_);
+  }
+
+  void Direct_Plugin::step() noexcept
+  {
+    step_(state_);
+  }
+}
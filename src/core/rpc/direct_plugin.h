@@ -0,0 +1,86 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <string>
+#include "dispatch.h"
+
+// Plugin libraries define these three functions with this macro. It's up to
+// the library what its state is, the engine just hands it back.
+//
+// UG_DIRECT_PLUGIN void* ug_plugin_start(ug::Direct_Host* host);
+// UG_DIRECT_PLUGIN void ug_plugin_step(void* state);
+// UG_DIRECT_PLUGIN void ug_plugin_stop(void* state);
+//
+// Plugins must also say which version of this interface they were built
+// against with UG_DIRECT_PLUGIN_ABI().
+#define UG_DIRECT_PLUGIN extern "C" __attribute__((visibility("default")))
+#define UG_DIRECT_PLUGIN_ABI() \
+  UG_DIRECT_PLUGIN int ug_plugin_abi() { return ug::Direct_Plugin_Abi; }
+
+namespace ug
+{
+  // Bumped whenever Direct_Host or the dispatcher's layout changes, since
+  // plugins share them with us as they are.
+  constexpr int Direct_Plugin_Abi = 1;
+
+  /*!
+   * \brief What a plugin library gets from the engine.
+   *
+   * Plugins look up methods once with the dispatcher, then call them with
+   * Req_Dispatcher::direct_method as often as they like.
+   */
+  struct Direct_Host
+  {
+    Req_Dispatcher const* dispatcher;
+  };
+
+  struct Plugin_Load_Error
+  {
+    std::string msg;
+  };
+
+  /*!
+   * \brief A trusted plugin loaded into the engine with dlopen.
+   *
+   * It calls our methods directly instead of sending us requests, the
+   * process boundary is only worth it for untrusted or scripted plugins.
+   */
+  struct Direct_Plugin
+  {
+    // \throws Plugin_Load_Error
+    Direct_Plugin(std::string const& path,
+                  Req_Dispatcher const& dispatcher);
+    ~Direct_Plugin() noexcept;
+
+    Direct_Plugin(Direct_Plugin const&) = delete;
+    Direct_Plugin& operator=(Direct_Plugin const&) = delete;
+
+    // Gives the plugin a chance to make its calls for this frame.
+    void step() noexcept;
+  private:
+    void* lib_;
+
+    void (*step_)(void*);
+    void (*stop_)(void*);
+
+    Direct_Host host_;
+    void* state_;
+  };
+}
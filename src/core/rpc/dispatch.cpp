@@ -20,24 +20,52 @@
 #include "dispatch.h"
 namespace ug
 {
-  void dispatch(std::vector<method_t>& methods, Request req,
-                Run_Context* ctx) noexcept
+  void set_error(Run_Context* ctx, int code, std::string const& msg) noexcept
   {
-    if(req.fn >= methods.size())
+    write_response(ctx, true, [&](auto& packer)
+    {
+      packer.pack_array(2);
+      packer.pack(code);
+      packer.pack(msg);
+    });
+  }
+  void set_result(Run_Context* ctx, Params const& params) noexcept
+  {
+    // Params are already an array.
+    write_response(ctx, false, [&params](auto& packer)
+    {
+      packer.pack(params.object.get());
+    });
+  }
+
+  optional<fn_t> Req_Dispatcher::method_id(std::string const& name) const
+    noexcept
+  {
+    auto id_find = ids_.find(name);
+    if(id_find == ids_.end()) return boost::none;
+    return id_find->second;
+  }
+
+  void Req_Dispatcher::dispatch(Request const& req, Run_Context* ctx) const
+    noexcept
+  {
+    if(req.fn >= methods_.size())
     {
       // Get the hell outta here before we jump to mysterious code.
+      set_error(ctx, static_cast<int>(Dispatch_Error::Unknown_Method),
+                "Unknown method");
       return;
     }
 
-    if(!req.params)
-    {
-      msgpack::object obj;
-      obj.type = msgpack::type::ARRAY;
-      obj.via.array.size = 0;
-      obj.via.array.ptr = nullptr;
+    // Requests without params are the same as an empty array, we don't need
+    // to allocate anything for that.
+    msgpack::object no_params;
+    no_params.type = msgpack::type::ARRAY;
+    no_params.via.array.size = 0;
+    no_params.via.array.ptr = nullptr;
 
-      req.params = Params{msgpack::clone(obj)};
-    }
-    (methods[req.fn])(ctx, *req.params);
+    Method const& method = methods_[req.fn];
+    method.invoke(method.fn, ctx,
+                  req.params ? req.params->object.get() : no_params);
   }
 }
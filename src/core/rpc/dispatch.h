@@ -18,20 +18,293 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <exception>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/variant.hpp>
+#include <msgpack.hpp>
 #include "req.h"
+#include "../io/buffer.h"
+#include "../common/pif/Msgpack.hpp"
 namespace ug
 {
+  /*!
+   * \brief Where the response of a method goes.
+   *
+   * Methods don't build a response object, whatever they return is packed
+   * straight into out as a complete response frame: [fn, [result], id] or
+   * [fn, [code, msg], id, true] if the method failed.
+   */
   struct Run_Context
   {
-    Run_Context() noexcept : is_error(false), response() {}
-    Run_Context(bool err, Params res) noexcept : is_error(err), response(res){}
+    Run_Context() noexcept {}
+    Run_Context(buf_t& out, fn_t fn, id_t id) noexcept
+      : out(&out), fn(fn), id(id) {}
 
-    bool is_error;
-    Params response;
+    // Nothing is packed if this is null, is_error is still set.
+    buf_t* out = nullptr;
+
+    // Of the request being responded to.
+    fn_t fn = 0;
+    id_t id = 0;
+
+    bool is_error = false;
   };
 
-  using method_t = std::function<void(Run_Context*, Params& params)>;
+  struct Error_Response
+  {
+    int code;
+    std::string msg;
+  };
+
+  // Errors reported by the dispatcher itself. The codes are borrowed from
+  // JSON-RPC so they can't clash with anything a method returns.
+  enum class Dispatch_Error : int
+  {
+    Unknown_Method = -32601,
+    Bad_Params = -32602,
+    // The method threw.
+    Internal = -32603
+  };
+
+  // Methods that can fail return this, methods that can't just return T.
+  template <class T>
+  using response_result = boost::variant<T, Error_Response>;
+
+  template <class F>
+  void write_response(Run_Context* ctx, bool is_error, F pack_params)
+    noexcept
+  {
+    if(!ctx) return;
+
+    ctx->is_error = is_error;
+    if(!ctx->out) return;
+
+    Buf_Stream stream{*ctx->out};
+    msgpack::packer<Buf_Stream> packer(stream);
+
+    packer.pack_array(is_error ? 4 : 3);
+    packer.pack(ctx->fn);
+    pack_params(packer);
+    packer.pack(ctx->id);
+    if(is_error) packer.pack(true);
+  }
+
+  void set_error(Run_Context* ctx, int code, std::string const& msg) noexcept;
+  void set_result(Run_Context* ctx, Params const& params) noexcept;
+
+  template <class T>
+  void set_result(Run_Context* ctx, T const& t) noexcept
+  {
+    write_response(ctx, false, [&t](auto& packer)
+    {
+      packer.pack_array(1);
+      packer.pack(t);
+    });
+  }
+  template <class T>
+  void set_result(Run_Context* ctx, response_result<T> const& res) noexcept
+  {
+    if(Error_Response const* err = boost::get<Error_Response>(&res))
+    {
+      set_error(ctx, err->code, err->msg);
+    }
+    else
+    {
+      set_result(ctx, boost::get<T>(res));
+    }
+  }
+
+  namespace detail
+  {
+    template <class... Args, class F, std::size_t... I>
+    inline decltype(auto) call_with_params(F& f,
+                                           msgpack::object const& params,
+                                           std::index_sequence<I...>)
+    {
+      return f(params.via.array.ptr[I].as<std::decay_t<Args> >()...);
+    }
+
+    // Decodes the params of a request straight into the arguments of a
+    // method, then packs its result. This is what actually ends up in the
+    // dispatch table.
+    template <class F, class... Args>
+    void invoke_method(void* fn, Run_Context* ctx,
+                       msgpack::object const& params) noexcept
+    {
+      if(params.type != msgpack::type::ARRAY ||
+         params.via.array.size != sizeof...(Args))
+      {
+        set_error(ctx, static_cast<int>(Dispatch_Error::Bad_Params),
+                  "Wrong number of params");
+        return;
+      }
+
+      try
+      {
+        set_result(ctx, call_with_params<Args...>(*static_cast<F*>(fn),
+                                  params, std::index_sequence_for<Args...>{}));
+      }
+      catch(msgpack::type_error&)
+      {
+        set_error(ctx, static_cast<int>(Dispatch_Error::Bad_Params),
+                  "Bad param type");
+      }
+      // Anything else would hit the noexcept and take the process down.
+      catch(std::exception& e)
+      {
+        set_error(ctx, static_cast<int>(Dispatch_Error::Internal), e.what());
+      }
+      catch(...)
+      {
+        set_error(ctx, static_cast<int>(Dispatch_Error::Internal),
+                  "Unknown exception");
+      }
+    }
+
+    // What a method returns when it succeeds.
+    template <class T> struct method_result { using type = T; };
+    template <class T> struct method_result<response_result<T> >
+    {
+      using type = T;
+    };
+
+    template <class F, class... Args>
+    using method_result_t = typename method_result<std::decay_t<
+      decltype(std::declval<F&>()(std::declval<std::decay_t<Args> >()...))
+    > >::type;
+
+    // Calls a method with arguments that are already the right type, this
+    // ends up in the dispatch table next to invoke_method.
+    template <class F, class... Args>
+    response_result<method_result_t<F, Args...> >
+      call_method(void* fn, std::decay_t<Args>... args) noexcept
+    {
+      return (*static_cast<F*>(fn))(std::move(args)...);
+    }
+  }
+
+  /*!
+   * \brief A method of a dispatcher called with typed arguments.
+   *
+   * Nothing is packed or unpacked along the way, calling one costs the same
+   * as calling through a function pointer.
+   */
+  template <class R, class... Args>
+  struct Direct_Method
+  {
+    using call_t = response_result<R> (*)(void*, std::decay_t<Args>...);
+
+    Direct_Method() noexcept {}
+    Direct_Method(call_t call, void* fn) noexcept : call_(call), fn_(fn) {}
+
+    // False if the method doesn't exist or has another signature.
+    explicit operator bool() const noexcept { return call_; }
+
+    response_result<R> operator()(std::decay_t<Args>... args) const noexcept
+    {
+      return call_(fn_, std::move(args)...);
+    }
+  private:
+    call_t call_ = nullptr;
+    void* fn_ = nullptr;
+  };
+
+  struct Req_Dispatcher
+  {
+    /*!
+     * \brief Adds a method that takes arguments of the given types.
+     *
+     * The method is called with the params of a request already converted
+     * to Args, requests with the wrong number or type of params never reach
+     * it.
+     *
+     * \returns The fn id requests must use to call the method.
+     */
+    template <class... Args, class F>
+    fn_t add_method(std::string const& name, F fn) noexcept;
+
+    optional<fn_t> method_id(std::string const& name) const noexcept;
+    inline std::size_t size() const noexcept;
+
+    /*!
+     * \brief Returns a method that can be called without going through
+     * msgpack.
+     *
+     * R and Args must be what the method returns on success and the types
+     * it was added with, otherwise the returned method is empty.
+     */
+    template <class R, class... Args>
+    Direct_Method<R, Args...> direct_method(fn_t fn) const noexcept;
+
+    void dispatch(Request const& req, Run_Context* ctx = nullptr) const
+      noexcept;
+  private:
+    using invoke_t = void (*)(void*, Run_Context*, msgpack::object const&);
+
+    struct Method
+    {
+      invoke_t invoke;
+      void* fn;
+
+      // A call_method instantiation, cast back once the signature matches.
+      void (*call)();
+      std::type_info const* signature;
+    };
+
+    // Indexed by fn id.
+    std::vector<Method> methods_;
+
+    // Owns the functions pointed to by the table above.
+    std::vector<std::shared_ptr<void> > fns_;
+
+    std::unordered_map<std::string, fn_t> ids_;
+  };
+
+  template <class... Args, class F>
+  fn_t Req_Dispatcher::add_method(std::string const& name, F fn) noexcept
+  {
+    auto fn_ptr = std::make_shared<F>(std::move(fn));
+
+    using res_t = detail::method_result_t<F, Args...>;
+
+    fn_t id = methods_.size();
+    methods_.push_back({&detail::invoke_method<F, Args...>, fn_ptr.get(),
+                        reinterpret_cast<void (*)()>(
+                          &detail::call_method<F, Args...>),
+                        &typeid(std::tuple<res_t, std::decay_t<Args>...>)});
+    fns_.push_back(std::move(fn_ptr));
+
+    // Adding a method with the same name again shadows the older one.
+    ids_[name] = id;
+    return id;
+  }
+
+  inline std::size_t Req_Dispatcher::size() const noexcept
+  {
+    return methods_.size();
+  }
+
+  template <class R, class... Args>
+  Direct_Method<R, Args...> Req_Dispatcher::direct_method(fn_t fn) const
+    noexcept
+  {
+    if(fn >= methods_.size()) return {};
+
+    // Type infos are compared by name, so this works across shared
+    // libraries too.
+    Method const& method = methods_[fn];
+    if(*method.signature != typeid(std::tuple<R, std::decay_t<Args>...>))
+    {
+      return {};
+    }
 
-  void dispatch(std::vector<method_t>& methods, Request req,
-                Run_Context* ctx = nullptr) noexcept;
+    using call_t = typename Direct_Method<R, Args...>::call_t;
+    return {reinterpret_cast<call_t>(method.call), method.fn};
+  }
 }
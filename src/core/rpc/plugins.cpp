@@ -22,25 +22,47 @@
 #include "../common/result.h"
 #include "../common/log.h"
 
+#include <algorithm>
+
 #include <msgpack.hpp>
 namespace ug
 {
+  constexpr std::size_t Msgpack_Plugin::Default_Flush_Threshold;
+
   Msgpack_Plugin::Msgpack_Plugin(std::unique_ptr<External_IO> io) noexcept
                                  : io_(std::move(io))
   {
-    io_->set_read_callback([this](const std::vector<uchar>& buf)
+    // Stream transports read straight into the unpacker.
+    io_->set_dest_callback([this](std::size_t size)
+    {
+      unpacker_.reserve_buffer(size);
+      return reinterpret_cast<uchar*>(unpacker_.buffer());
+    });
+    io_->set_view_callback([this](Buf_View buf)
     {
-      unpacker_.reserve_buffer(buf.size());
-      std::memcpy(unpacker_.buffer(), &buf[0], buf.size());
+      // Anything else still has to be copied in.
+      if(buf.data() != reinterpret_cast<uchar*>(unpacker_.buffer()))
+      {
+        unpacker_.reserve_buffer(buf.size());
+        std::memcpy(unpacker_.buffer(), buf.data(), buf.size());
+      }
       unpacker_.buffer_consumed(buf.size());
 
+      Scoped_Timer timer{stats_.decode_time};
       msgpack::unpacked unpacked;
       while(unpacker_.next(&unpacked))
       {
         raw_reqs_.push(std::move(unpacked));
+        ++stats_.frames;
       }
+      count_queued_();
     });
   }
+  Msgpack_Plugin::~Msgpack_Plugin() noexcept
+  {
+    // Don't lose any responses, unless we were moved from.
+    if(io_) flush();
+  }
 
   enum class Req_Err
   {
@@ -52,9 +74,16 @@ namespace ug
     Unknown
   };
 
+  // Make_Params is given the params object of the request and decides how
+  // the returned Params keep its zone alive.
+  template <class Make_Params>
   Result<bool, Req_Err>
-    try_make_request(Request& req, msgpack::object const& obj) noexcept
+    try_make_request(Request& req, msgpack::object const& obj,
+                     Make_Params make_params) noexcept
   {
+    // Requests are only part of a batch if the caller says so.
+    req.batch = boost::none;
+
     if(obj.type != msgpack::type::ARRAY)
     {
       return err(Req_Err::NoArray);
@@ -81,8 +110,7 @@ namespace ug
       // The second element must either be an array or an id
       if(obj.via.array.ptr[1].type == msgpack::type::ARRAY)
       {
-        Params p;
-        p.object = msgpack::clone(obj.via.array.ptr[1]);
+        Params p = make_params(obj.via.array.ptr[1]);
 
         // Do we have a third parameter?
         if(obj.via.array.size >= 3)
@@ -134,46 +162,139 @@ namespace ug
     }
   }
 
-  bool Msgpack_Plugin::poll_request(Request& req)
+  // The params of a successful request take over the handle's zone, so the
+  // handle should be considered spent after this call.
+  Result<bool, Req_Err>
+    try_make_request(Request& req, msgpack::object_handle& handle) noexcept
   {
-    io_->step();
+    return try_make_request(req, handle.get(),
+    [&handle](msgpack::object const& params)
+    {
+      // The params object already lives in the unpacked handle's zone,
+      // just take that over instead of cloning the whole tree.
+      return Params{params, std::move(handle.zone())};
+    });
+  }
 
-    // If we have one...
-    if(raw_reqs_.size())
+  // A batch is an array of requests, which can't be confused with a single
+  // request since those always start with the function.
+  bool is_batch(msgpack::object const& obj) noexcept
+  {
+    return obj.type == msgpack::type::ARRAY && obj.via.array.size >= 1 &&
+           obj.via.array.ptr[0].type == msgpack::type::ARRAY;
+  }
+
+  void Msgpack_Plugin::expand_batch_(msgpack::object_handle& handle) noexcept
+  {
+    // Every request in the batch shares the zone of the frame.
+    std::shared_ptr<msgpack::zone> zone = std::move(handle.zone());
+    std::size_t batch = next_batch_++;
+
+    msgpack::object const& obj = handle.get();
+    for(std::size_t i = 0; i < obj.via.array.size; ++i)
     {
-      // make sense of it and try to return it.
-      msgpack::object obj = raw_reqs_.front().get();
+      Request req;
+      auto req_res = try_make_request(req, obj.via.array.ptr[i],
+      [&zone](msgpack::object const& params)
+      {
+        return Params{params, zone};
+      });
 
+      // Drop bad requests, but keep the rest of the batch.
+      if(req_res.ok() && *req_res.ok())
+      {
+        req.batch = batch;
+        batch_reqs_.push(std::move(req));
+      }
+      else ++stats_.bad_requests;
+    }
+    ++stats_.batches;
+  }
+
+  bool Msgpack_Plugin::next_request_(Request& req) noexcept
+  {
+    // Batches can expand to nothing, so keep going until there's a request
+    // or nothing left.
+    while(true)
+    {
+      // Requests left over from a batch come first.
+      if(batch_reqs_.size())
+      {
+        req = std::move(batch_reqs_.front());
+        batch_reqs_.pop();
+        ++stats_.requests;
+        return true;
+      }
+
+      // Otherwise just bail out
+      if(!raw_reqs_.size()) return false;
+
+      // Split up batches and start returning their requests.
+      if(is_batch(raw_reqs_.front().get()))
+      {
+        expand_batch_(raw_reqs_.front());
+        raw_reqs_.pop();
+        count_queued_();
+        continue;
+      }
+
+      // make sense of it and try to return it.
       bool ret = false;
 
-      auto req_res = try_make_request(req, obj);
+      auto req_res = try_make_request(req, raw_reqs_.front());
       // Can we guarantee that the second condition will not be evaluated as
       // long as the first one is false?
       if(req_res.ok() && *req_res.ok())
       {
         ret = true;
+        ++stats_.requests;
       }
+      else ++stats_.bad_requests;
 
       // Don't forget to pop the front object!
       raw_reqs_.pop();
       return ret;
     }
+  }
 
-    // Otherwise just bail out
-    return false;
+  bool Msgpack_Plugin::poll_request(Request& req)
+  {
+    io_->step();
+    if(!next_request_(req)) return false;
+
+    UG_LOG(Debug, Rpc, "Polled a request for method %", req.fn);
+    return true;
+  }
+
+  std::size_t Msgpack_Plugin::poll_requests(std::vector<Request>& reqs,
+                                            std::size_t max)
+  {
+    reqs.clear();
+
+    // One step for the whole batch, then drain whatever made it through.
+    io_->step();
+
+    Request req;
+    while(reqs.size() < max && (raw_reqs_.size() || batch_reqs_.size()))
+    {
+      // Bad requests are dropped, but they shouldn't end the batch early.
+      if(next_request_(req)) reqs.push_back(std::move(req));
+    }
+    return reqs.size();
   }
 
   void Msgpack_Plugin::post_request(Request const& res) noexcept
   {
-    std::ostringstream buf;
-    msgpack::packer<std::ostringstream> packer(buf);
+    Buf_Stream stream{out_buf_};
+    msgpack::packer<Buf_Stream> packer(stream);
 
     if(res.params && res.id)
     {
       if(res.params->object.get().type != msgpack::type::ARRAY)
       {
         // What do we do?
-        UG_LOG_E("Response object with id % has bad params object.");
+        UG_LOG(Error, Rpc, "Response object with id % has bad params object.",
+               *res.id);
       }
 
       packer.pack_array(3);
@@ -199,7 +320,96 @@ namespace ug
       packer.pack_array(1);
       packer.pack(res.fn);
     }
-    io_->write(buf_from_string(buf.str()));
+
+    if(out_buf_.size() >= flush_threshold_) flush();
+  }
+
+  Run_Context Msgpack_Plugin::response_context(Request const& req) noexcept
+  {
+    // Nobody is waiting for a response without an id.
+    if(!req.id) return Run_Context{};
+
+    if(req.batch)
+    {
+      // Responses to a batch are collected until the batch is over.
+      if(open_batch_ != req.batch)
+      {
+        end_batch_();
+        open_batch_ = req.batch;
+      }
+
+      ++batch_responses_;
+      return Run_Context{batch_buf_, req.fn, *req.id};
+    }
+
+    end_batch_();
+
+    // Since we can't know how big the response will be, make sure we are
+    // under the threshold before it's packed.
+    if(out_buf_.size() >= flush_threshold_) flush();
+
+    return Run_Context{out_buf_, req.fn, *req.id};
+  }
+
+  void Msgpack_Plugin::end_batch_() noexcept
+  {
+    open_batch_ = boost::none;
+    if(!batch_responses_) return;
+
+    // Answer the whole batch with one array of responses.
+    Buf_Stream stream{out_buf_};
+    msgpack::packer<Buf_Stream> packer(stream);
+    packer.pack_array(batch_responses_);
+
+    out_buf_.insert(out_buf_.end(), batch_buf_.begin(), batch_buf_.end());
+
+    batch_buf_.clear();
+    batch_responses_ = 0;
+  }
+
+  void Msgpack_Plugin::flush() noexcept
+  {
+    // A batch can't span frames.
+    end_batch_();
+
+    if(out_buf_.empty()) return;
+
+    // Every response since the last flush goes out in one write.
+    io_->write(out_buf_);
     io_->step();
+
+    ++stats_.flushes;
+    stats_.bytes_flushed += out_buf_.size();
+
+    out_buf_.clear();
+  }
+
+  Plugin_Stats Msgpack_Plugin::stats() const noexcept
+  {
+    Plugin_Stats ret = stats_;
+    ret.queued = raw_reqs_.size() + batch_reqs_.size();
+    ret.io = io_->io_stats();
+    return ret;
+  }
+
+  void Msgpack_Plugin::count_queued_() noexcept
+  {
+    // A batch is one frame until it's split up, count both queues.
+    stats_.peak_queued = std::max(stats_.peak_queued,
+                                  raw_reqs_.size() + batch_reqs_.size());
+  }
+
+  DEFINE_PROPERTY_VALUES(Plugin_Stats);
+
+  std::string describe(Plugin_Stats const& stats) noexcept
+  {
+    return std::to_string(stats.requests) + " requests (" +
+           std::to_string(stats.bad_requests) + " bad) in " +
+           std::to_string(stats.frames) + " frames, " +
+           std::to_string(stats.peak_queued) + " queued at most, " +
+           "decoding: " + describe(stats.decode_time) + ", " +
+           std::to_string(stats.bytes_flushed) + " bytes in " +
+           std::to_string(stats.flushes) + " flushes, io: " +
+           describe(stats.io);
   }
 }
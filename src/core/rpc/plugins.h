@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <limits>
 #include <memory>
 #include <queue>
 #include <vector>
@@ -25,19 +26,82 @@
 #include <boost/optional.hpp>
 #include <msgpack.hpp>
 #include "req.h"
+#include "dispatch.h"
 #include "../io/external_io.h"
+#include "../common/stats.h"
 namespace ug
 {
+  struct Plugin_Stats
+  {
+    // Msgpack objects decoded, a batch is one of them.
+    std::size_t frames = 0;
+    std::size_t batches = 0;
+    std::size_t requests = 0;
+    // Frames and requests in a batch that weren't valid requests.
+    std::size_t bad_requests = 0;
+
+    std::size_t flushes = 0;
+    std::size_t bytes_flushed = 0;
+
+    // Requests decoded but not returned yet.
+    std::size_t queued = 0;
+    std::size_t peak_queued = 0;
+
+    // Decoding every frame of a read.
+    Latency_Histogram decode_time;
+
+    IO_Stats io;
+
+    DECLARE_FORMATTED_AS_OBJECT;
+    DECLARE_PROPERTY_VALUES(10, "Frames", "Batches", "Requests",
+                            "Bad_Requests", "Flushes", "Bytes_Flushed",
+                            "Queued", "Peak_Queued", "Decode_Time", "IO");
+    DECLARE_PROPERTIES_TUPLE(std::size_t, std::size_t, std::size_t,
+                             std::size_t, std::size_t, std::size_t,
+                             std::size_t, std::size_t, Latency_Histogram,
+                             IO_Stats);
+    DECLARE_PROPERTIES(frames, batches, requests, bad_requests, flushes,
+                       bytes_flushed, queued, peak_queued, decode_time, io);
+  };
+
+  std::string describe(Plugin_Stats const& stats) noexcept;
+
   struct Plugin
   {
     virtual bool poll_request(Request& req) = 0;
+
+    /*!
+     * \brief Replaces the contents of reqs with up to max pending requests.
+     *
+     * Unlike poll_request, the underlying io is only stepped once no matter
+     * how many requests are returned. The vector is cleared but its storage
+     * is kept so it can be reused every frame.
+     *
+     * \returns The amount of requests put in reqs.
+     */
+    virtual std::size_t poll_requests(std::vector<Request>& reqs,
+                                      std::size_t max) = 0;
+
     virtual void post_request(Request const& res) noexcept = 0;
+
+    /*!
+     * \brief Sends every request posted since the last flush.
+     *
+     * Should be called at least once per frame.
+     */
+    virtual void flush() noexcept = 0;
+
+    // Counted all the time, this is cheap enough to call every frame.
+    virtual Plugin_Stats stats() const noexcept = 0;
   };
 
   struct Msgpack_Plugin : public Plugin
   {
+    // Responses are flushed automatically once this many bytes are pending.
+    static constexpr std::size_t Default_Flush_Threshold = 64 * 1024;
+
     Msgpack_Plugin(std::unique_ptr<External_IO> io) noexcept;
-    ~Msgpack_Plugin() noexcept = default;
+    ~Msgpack_Plugin() noexcept;
 
     Msgpack_Plugin(Msgpack_Plugin&&) = default;
     Msgpack_Plugin(Msgpack_Plugin const&) noexcept = delete;
@@ -46,13 +110,62 @@ namespace ug
     Msgpack_Plugin& operator=(Msgpack_Plugin const&) noexcept = delete;
 
     bool poll_request(Request& req) override;
+    std::size_t poll_requests(std::vector<Request>& reqs, std::size_t max =
+                              std::numeric_limits<std::size_t>::max())
+                              override;
     void post_request(Request const& res) noexcept override;
+    void flush() noexcept override;
+    Plugin_Stats stats() const noexcept override;
+
+    /*!
+     * \brief Returns a context that packs the response to req straight into
+     * our pending output.
+     *
+     * The response goes out with the next flush, like any posted request.
+     * The context is only valid until then.
+     */
+    Run_Context response_context(Request const& req) noexcept;
+
+    inline void flush_threshold(std::size_t size) noexcept;
+    inline std::size_t flush_threshold() const noexcept;
 
     inline External_IO& io() noexcept { return *this->io_; }
     inline External_IO const& io() const noexcept { return *this->io_; }
   private:
+    bool next_request_(Request& req) noexcept;
+    void expand_batch_(msgpack::object_handle& handle) noexcept;
+    void end_batch_() noexcept;
+    void count_queued_() noexcept;
+
     std::unique_ptr<External_IO> io_;
     msgpack::unpacker unpacker_;
     std::queue<msgpack::object_handle> raw_reqs_;
+
+    // Requests of the last batch that haven't been returned yet.
+    std::queue<Request> batch_reqs_;
+    std::size_t next_batch_ = 0;
+
+    // Packed responses waiting for the next flush. Cleared, not freed, so
+    // the storage is reused from frame to frame.
+    buf_t out_buf_;
+    std::size_t flush_threshold_ = Default_Flush_Threshold;
+
+    // Responses to the batch currently being answered, they are moved to
+    // out_buf_ as one array once it's over.
+    buf_t batch_buf_;
+    std::size_t batch_responses_ = 0;
+    optional<std::size_t> open_batch_;
+
+    // Queue sizes and transport stats are filled in by stats().
+    Plugin_Stats stats_;
   };
+
+  inline void Msgpack_Plugin::flush_threshold(std::size_t size) noexcept
+  {
+    flush_threshold_ = size;
+  }
+  inline std::size_t Msgpack_Plugin::flush_threshold() const noexcept
+  {
+    return flush_threshold_;
+  }
 }
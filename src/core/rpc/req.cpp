@@ -29,20 +29,25 @@ namespace ug
     : object(obj, std::move(zone)) {}
   Params::Params(msgpack::object_handle&& obj) noexcept
     : object(std::move(obj)) {}
+  Params::Params(msgpack::object const& obj,
+                 std::shared_ptr<msgpack::zone> zone) noexcept
+    : object(obj, nullptr), shared_zone(std::move(zone)) {}
 
   Params::Params(Params const& p) noexcept
     : object(msgpack::clone(p.object.get())) {}
   Params::Params(Params&& p) noexcept
-    : object(std::move(p.object)) {}
+    : object(std::move(p.object)), shared_zone(std::move(p.shared_zone)) {}
 
   Params& Params::operator=(Params const& p) noexcept
   {
     this->object = msgpack::clone(p.object.get());
+    this->shared_zone = nullptr;
     return *this;
   }
   Params& Params::operator=(Params&& p) noexcept
   {
     this->object = std::move(p.object);
+    this->shared_zone = std::move(p.shared_zone);
     return *this;
   }
 }
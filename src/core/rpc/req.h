@@ -19,6 +19,7 @@
  */
 #pragma once
 
+#include <memory>
 #include <string>
 #include <boost/optional.hpp>
 #include <msgpack.hpp>
@@ -39,6 +40,11 @@ namespace ug
            std::unique_ptr<msgpack::zone> zone) noexcept;
     Params(msgpack::object_handle&& obj) noexcept;
 
+    // For params that live in a zone shared with other params, like every
+    // request of a batch.
+    Params(msgpack::object const& obj,
+           std::shared_ptr<msgpack::zone> zone) noexcept;
+
     Params(Params const& p) noexcept;
     Params(Params&& p) noexcept;
 
@@ -46,6 +52,9 @@ namespace ug
     Params& operator=(Params&& p) noexcept;
 
     msgpack::object_handle object;
+
+    // Keeps a shared zone alive, the handle's own zone is null in that case.
+    std::shared_ptr<msgpack::zone> shared_zone;
   };
 
   template <std::size_t Where>
@@ -95,5 +104,9 @@ namespace ug
 
     // and parameters.
     optional<Params> params;
+
+    // Set when the request came in a batch. Responses to requests of the
+    // same batch are sent back together.
+    optional<std::size_t> batch;
   };
 }
@@ -28,7 +28,8 @@ namespace engine
                       Fn const& fn)
   {
     dispatch.add_method<ug::id_type, Member>(method,
-    [&map, &fn](ug::id_type id, Member const& t) -> ug::response_result
+    [&map, fn](ug::id_type id, Member const& t)
+      -> ug::response_result<bool>
     {
       try
       {
@@ -38,7 +39,7 @@ namespace engine
       {
         return ug::Error_Response{4, "Invalid id"};
       }
-      return Json::Value(true);
+      return true;
     });
   }
   template <class Member, class Object, class Fn>
@@ -48,12 +49,12 @@ namespace engine
                       Fn const& fn)
   {
     dispatch.add_method<ug::id_type>(method,
-    [&map, &fn](ug::id_type id) -> ug::response_result
+    [&map, fn](ug::id_type id) -> ug::response_result<Member>
     {
       try
       {
-        auto const& value = fn(map.find(id));
-        return FORMATTER_TYPE(Member)::dump(value);
+        // Packed as is by the dispatcher, no json or msgpack tree involved.
+        return Member{fn(map.find(id))};
       }
       catch(std::out_of_range& e)
       {
@@ -68,10 +69,9 @@ namespace engine
     using ug::Vec;
 
     dispatch.add_method<>("Label.Create_Label",
-    [&state]() -> ug::response_result
+    [&state]()
     {
-      ug::id_type id = state.labels_.insert(ug::Label<std::string>{});
-      return Json::Value(id);
+      return state.labels_.insert(ug::Label<std::string>{});
     });
 
     add_set_method<std::string>("Label.Set_String", dispatch, state.labels_,
@@ -0,0 +1,107 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <thread>
+#include <catch.hpp>
+#include "common/buffer_pool.h"
+
+namespace
+{
+  // Gives a block back as its thread exits, after the thread's pools were
+  // emptied.
+  struct Late_Release
+  {
+    ~Late_Release() noexcept
+    {
+      ug::Buffer_Pool& pool = ug::io_buffer_pool();
+      pool.release(block, pool.block_size());
+      *kept = pool.free_blocks();
+    }
+
+    char* block = nullptr;
+    std::size_t* kept = nullptr;
+  };
+}
+
+TEST_CASE("Buffer pool reuses blocks", "[buffer_pool]")
+{
+  ug::Buffer_Pool pool{128, 2};
+
+  char* first = pool.acquire(100);
+  char* second = pool.acquire(128);
+  CHECK(pool.stats().allocated == 2);
+  CHECK(pool.stats().in_use == 2);
+
+  pool.release(first, 100);
+  pool.release(second, 128);
+  CHECK(pool.free_blocks() == 2);
+  CHECK(pool.stats().in_use == 0);
+
+  // The last one released comes back first.
+  CHECK(pool.acquire(10) == second);
+  CHECK(pool.acquire(10) == first);
+  CHECK(pool.stats().allocated == 2);
+  CHECK(pool.stats().acquired == 4);
+  CHECK(pool.stats().peak_in_use == 2);
+
+  pool.release(first, 10);
+  pool.release(second, 10);
+
+  SECTION("Only so many blocks are kept")
+  {
+    char* bufs[3];
+    for(char*& buf : bufs) buf = pool.acquire(128);
+    CHECK(pool.stats().allocated == 3);
+
+    for(char* buf : bufs) pool.release(buf, 128);
+    CHECK(pool.free_blocks() == 2);
+  }
+  SECTION("Oversized buffers aren't pooled")
+  {
+    char* big = pool.acquire(129);
+    CHECK(pool.stats().oversized == 1);
+    CHECK(pool.stats().in_use == 0);
+
+    pool.release(big, 129);
+    CHECK(pool.free_blocks() == 2);
+  }
+}
+TEST_CASE("Thread pools are emptied when their thread exits",
+          "[buffer_pool]")
+{
+  std::size_t kept_before = 0;
+  std::size_t kept = 1;
+  std::thread thread([&]()
+  {
+    // Made before the pool, so it's destroyed after it.
+    thread_local Late_Release late;
+    late.kept = &kept;
+
+    ug::Buffer_Pool& pool = ug::io_buffer_pool();
+    late.block = pool.acquire(pool.block_size());
+    pool.release(pool.acquire(pool.block_size()), pool.block_size());
+    kept_before = pool.free_blocks();
+  });
+  thread.join();
+
+  CHECK(kept_before == 1);
+  // The block kept on the free list was freed along with the thread, the
+  // late one was freed as it came back.
+  CHECK(kept == 0);
+}
@@ -0,0 +1,63 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <climits>
+#include <catch.hpp>
+#include "common/format.h"
+
+TEST_CASE("Format replaces placeholders in order", "[format]")
+{
+  CHECK(ug::format_str("Plugin %: %", 3, std::string{"ok"}) == "Plugin 3: ok");
+  CHECK(ug::format_str("No placeholders") == "No placeholders");
+
+  // Leftover placeholders are kept, leftover arguments are ignored.
+  CHECK(ug::format_str("% and %", "one") == "one and %");
+  CHECK(ug::format_str("Just %", 1, 2) == "Just 1");
+  CHECK(ug::format_str("%%", 'a', true) == "971");
+}
+TEST_CASE("Format writes numbers like std::to_string", "[format]")
+{
+  for(long long v : {0ll, 7ll, -7ll, 10ll, 99ll, 100ll, -12345ll, LLONG_MAX,
+                     LLONG_MIN})
+  {
+    CHECK(ug::format_str("%", v) == std::to_string(v));
+  }
+  CHECK(ug::format_str("%", ULLONG_MAX) == std::to_string(ULLONG_MAX));
+  CHECK(ug::format_str("%", (unsigned char) 200) == "200");
+
+  for(double v : {0.0, 1.5, -2.25, 1e20, 1e300, -1e-7})
+  {
+    CHECK(ug::format_str("%", v) == std::to_string(v));
+  }
+  CHECK(ug::format_str("%", 0.5f) == std::to_string(0.5f));
+}
+TEST_CASE("Format templates are split up once", "[format]")
+{
+  ug::Format_Template tmpl{"Hello %, you are %!"};
+  REQUIRE(tmpl.holes.size() == 2);
+
+  CHECK(ug::format(tmpl, "Luke", 22) == "Hello Luke, you are 22!");
+  CHECK(ug::format(tmpl, "Luke") == "Hello Luke, you are %!");
+
+  // Appends to what's already there.
+  std::string out = "> ";
+  ug::format_to(out, tmpl, "you", 1);
+  ug::format_to(out, " and %", 2);
+  CHECK(out == "> Hello you, you are 1! and 2");
+}
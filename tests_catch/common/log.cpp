@@ -0,0 +1,166 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Debug messages are compiled out in here.
+#define UG_LOG_MIN_SEVERITY 1
+
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <catch.hpp>
+#include "common/log.h"
+#include "common/log_binary.h"
+
+namespace
+{
+  std::vector<std::string> read_lines(std::string const& path)
+  {
+    std::vector<std::string> lines;
+    std::ifstream file{path};
+    for(std::string line; std::getline(file, line);) lines.push_back(line);
+    return lines;
+  }
+}
+
+TEST_CASE("Log messages from every thread are written", "[log]")
+{
+  constexpr int Threads = 4;
+  constexpr int Messages = 500;
+
+  std::string path = "/tmp/ug_log_" + std::to_string(getpid());
+  unlink(path.c_str());
+  ug::set_log_filename(path.c_str());
+
+  ug::Scoped_Log_Init log_init;
+  auto dropped = ug::dropped_log_messages();
+
+  std::vector<std::thread> threads;
+  for(int t = 0; t < Threads; ++t)
+  {
+    threads.emplace_back([t]()
+    {
+      for(int i = 0; i < Messages; ++i) ug::log_i("Thread % says %", t, i);
+    });
+  }
+  for(auto& thread : threads) thread.join();
+
+  // Less severe than the level never even gets queued.
+  ug::set_out_log_level(ug::Log_Severity::Warning);
+  ug::log_i("Not written");
+  ug::log_e("Written");
+  ug::set_out_log_level(ug::Log_Severity::Info);
+
+  ug::flush_log_full();
+  auto lines = read_lines(path);
+  CHECK(lines.size() + ug::dropped_log_messages() - dropped ==
+        Threads * Messages + 1);
+
+  // Each thread's messages come out in order.
+  std::vector<int> next(Threads, 0);
+  bool in_order = true;
+  for(auto const& line : lines)
+  {
+    auto says = line.find(" says ");
+    if(says == std::string::npos) continue;
+    int t = line[says - 1] - '0';
+    int i = std::stoi(line.substr(says + 6));
+    if(i < next[t]) in_order = false;
+    next[t] = i + 1;
+  }
+  CHECK(in_order);
+
+  REQUIRE_FALSE(lines.empty());
+  CHECK(lines.back().find("error: Written") != std::string::npos);
+
+  ug::set_log_filename(nullptr);
+  unlink(path.c_str());
+}
+TEST_CASE("Filtered log calls don't evaluate their arguments", "[log]")
+{
+  int evaluated = 0;
+  auto arg = [&]()
+  {
+    return ++evaluated;
+  };
+
+  // Compiled out, whatever the level.
+  ug::set_out_log_level(ug::Log_Severity::Debug);
+  UG_LOG_D("Debug %", arg());
+  CHECK(evaluated == 0);
+
+  // Filtered at runtime for one subsystem only.
+  ug::set_log_level(ug::Log_Subsystem::Rpc, ug::Log_Severity::Warning);
+  UG_LOG(Info, Rpc, "Info %", arg());
+  CHECK(evaluated == 0);
+  CHECK(ug::log_enabled(ug::Log_Severity::Info, ug::Log_Subsystem::IO));
+
+  UG_LOG(Warning, Rpc, "Warning %", arg());
+  CHECK(evaluated == 1);
+
+  ug::set_out_log_level(ug::Log_Severity::Info);
+  CHECK(ug::log_level(ug::Log_Subsystem::Rpc) == ug::Log_Severity::Info);
+}
+TEST_CASE("Binary logs decode to the text log", "[log]")
+{
+  std::string path = "/tmp/ug_binary_log_" + std::to_string(getpid());
+  unlink(path.c_str());
+  ug::set_log_filename(path.c_str());
+  ug::set_log_format(ug::Log_Format::Binary);
+
+  {
+    ug::Scoped_Log_Init log_init;
+    for(int i = -1; i < 2; ++i)
+    {
+      UG_LOG(Info, Physics, "Body % at %", i, 1.5);
+    }
+    UG_LOG_W("Plugin %", std::string{"pong"});
+    ug::log_e("Formatted already");
+    ug::flush_log_full();
+  }
+  ug::set_log_format(ug::Log_Format::Text);
+  ug::set_log_filename(nullptr);
+
+  std::ifstream file{path, std::ios::binary};
+  std::ostringstream out;
+  REQUIRE(ug::decode_binary_log(file, out));
+
+  std::vector<std::string> lines;
+  std::istringstream text{out.str()};
+  for(std::string line; std::getline(text, line);) lines.push_back(line);
+  REQUIRE(lines.size() == 5);
+
+  auto ends_with = [](std::string const& line, std::string const& end)
+  {
+    return line.size() >= end.size() &&
+           line.compare(line.size() - end.size(), end.size(), end) == 0;
+  };
+  CHECK(ends_with(lines[0], "): info: Body -1 at 1.500000\x1b[0m"));
+  CHECK(ends_with(lines[2], "): info: Body 1 at 1.500000\x1b[0m"));
+  CHECK(ends_with(lines[3], "): warning: Plugin pong\x1b[0m"));
+  CHECK(ends_with(lines[4], "): error: Formatted already\x1b[0m"));
+  CHECK(lines[3].compare(0, 6, "\x1b[91m(") == 0);
+
+  // Text logs aren't binary logs.
+  std::istringstream not_binary{"(2015-01-01|00:00:00): info: Hi\n"};
+  std::ostringstream ignored;
+  CHECK_FALSE(ug::decode_binary_log(not_binary, ignored));
+
+  unlink(path.c_str());
+}
@@ -0,0 +1,45 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <catch.hpp>
+#include "common/stats.h"
+
+TEST_CASE("Latency histogram buckets by powers of two", "[stats]")
+{
+  ug::Latency_Histogram h;
+  CHECK(h.percentile(.5) == 0);
+
+  h.record(0);
+  h.record(1);
+  h.record(3);
+  h.record(1000);
+  h.record(uint64_t(1) << 40);
+
+  CHECK(h.count == 5);
+  CHECK(h.buckets[0] == 2);
+  CHECK(h.buckets[1] == 1);
+  CHECK(h.buckets[9] == 1);
+  // Way too long still ends up somewhere.
+  CHECK(h.buckets[ug::Latency_Histogram::Bucket_Count - 1] == 1);
+  CHECK(h.max_ns == uint64_t(1) << 40);
+
+  CHECK(h.percentile(.5) == 4);
+  CHECK(h.percentile(.7) == 1024);
+  CHECK(h.percentile(1) == h.max_ns);
+}
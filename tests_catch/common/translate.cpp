@@ -0,0 +1,93 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2015 Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <thread>
+#include <catch.hpp>
+#include "common/translate.h"
+
+TEST_CASE("Translations are looked up by interned key", "[translate]")
+{
+  ug::Lang english;
+  english.dict["menu.play"] = "Play";
+  english.dict["hud.score"] = "Score: %";
+  ug::Lang french;
+  french.dict["menu.play"] = "Jouer";
+  ug::set_lang(english);
+
+  auto score = ug::lang_key("hud.score");
+  CHECK(score.id == ug::lang_key("hud.score").id);
+  CHECK(score.id != ug::lang_key("menu.play").id);
+
+  CHECK(ug::t("menu.play") == "Play");
+  CHECK(ug::t(score, 42) == "Score: 42");
+
+  // A table that is held on to outlives the switch, until it's reclaimed.
+  auto held = ug::get_lang();
+  ug::set_lang(french);
+  CHECK(ug::t("menu.play") == "Jouer");
+  REQUIRE(held->find(score));
+  CHECK(ug::format(*held->find(score), 7) == "Score: 7");
+
+  // Only the current table is left.
+  ug::reclaim_langs();
+  CHECK(ug::t("menu.play") == "Jouer");
+
+  // Missing keys come out as they are.
+  CHECK(ug::t(score, 42) == "hud.score");
+  CHECK(ug::t("hud.lives %", 3) == "hud.lives 3");
+
+  // Looking strings up doesn't intern them.
+  auto before = ug::lang_key("test.before");
+  CHECK(ug::t("test.not_interned") == "test.not_interned");
+  CHECK(ug::lang_key("test.after").id == before.id + 1);
+}
+TEST_CASE("Languages can be switched while others translate",
+          "[translate]")
+{
+  ug::Lang one;
+  one.dict["n"] = "1";
+  ug::Lang two;
+  two.dict["n"] = "2";
+  ug::set_lang(one);
+
+  std::atomic<bool> done{false};
+  std::atomic<int> bad{0};
+  std::thread reader([&]()
+  {
+    auto key = ug::lang_key("n");
+    while(!done.load())
+    {
+      auto str = ug::t(key);
+      if(str != "1" && str != "2") ++bad;
+    }
+  });
+  // Every switch compiles a new table, the reader may still be using the
+  // one it replaces.
+  for(int i = 0; i < 10000; ++i)
+  {
+    ug::set_lang(i % 2 ? one : two);
+  }
+  done.store(true);
+  reader.join();
+  CHECK(bad.load() == 0);
+
+  ug::reclaim_langs();
+  CHECK(ug::t("n") == "1");
+}
@@ -0,0 +1,171 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "rpc/plugins.h"
+#include "common/buffer_pool.h"
+
+namespace
+{
+  char cat_name[] = "cat";
+  char* cat_args[] = {cat_name, NULL};
+}
+
+TEST_CASE("Child_Process passes msgpack through untouched", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  // cat sends our requests right back. The handshake comes back too, but
+  // the plugin drops it since it isn't a request.
+  ug::Msgpack_Plugin plugin{std::make_unique<ug::Child_Process>(opt, ctx)};
+
+  // Newlines used to cut frames in half.
+  std::string payload(100000, 'x');
+  payload[10] = '\n';
+  payload[50000] = '\n';
+
+  ug::Request req;
+  req.fn = 2;
+  req.id = 1;
+  req.params = ug::make_params(payload);
+  plugin.post_request(req);
+  plugin.flush();
+
+  std::vector<ug::Request> reqs;
+  for(int tries = 0; reqs.empty() && tries < 100; ++tries)
+  {
+    ctx.step(100);
+    plugin.poll_requests(reqs, 1);
+  }
+
+  REQUIRE(reqs.size() == 1);
+  CHECK(reqs[0].fn == 2);
+  REQUIRE(reqs[0].params);
+  CHECK(std::get<0>(reqs[0].params->object.get()
+                    .as<std::tuple<std::string> >()) == payload);
+}
+TEST_CASE("Child_Process can split output into lines", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  ug::Child_Process proc{opt, ctx, ug::ipc::Framing::Lines};
+
+  std::vector<std::string> lines;
+  proc.set_read_callback([&](ug::buf_t const& buf)
+  {
+    lines.emplace_back(buf.begin(), buf.end());
+  });
+
+  // Empty lines are skipped.
+  proc.write(ug::buf_from_string("One\nTwo\n\nThree\n"));
+
+  for(int tries = 0; lines.size() < 3 && tries < 100; ++tries) ctx.step(100);
+
+  REQUIRE(lines.size() == 3);
+  CHECK(lines[0] == "PpMOne");
+  CHECK(lines[1] == "Two");
+  CHECK(lines[2] == "Three");
+}
+TEST_CASE("Child_Process reuses its read buffers", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  ug::Child_Process proc{opt, ctx};
+
+  std::size_t received = 0;
+  proc.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received += buf.size();
+  });
+
+  auto msg = ug::buf_from_string("Hello");
+  auto echo = [&]()
+  {
+    std::size_t expected = received + msg.size();
+    proc.write(msg);
+    for(int tries = 0; received < expected && tries < 100; ++tries)
+    {
+      ctx.step(100);
+    }
+    return received == expected;
+  };
+
+  // Warm up with the handshake, which cat sends back.
+  for(int tries = 0; received < 3 && tries < 100; ++tries) ctx.step(100);
+  REQUIRE(received == 3);
+
+  auto const& stats = ug::io_buffer_pool().stats();
+  auto allocated = stats.allocated;
+  auto acquired = stats.acquired;
+
+  for(int i = 0; i < 20; ++i) REQUIRE(echo());
+
+  CHECK(stats.acquired > acquired);
+  CHECK(stats.allocated == allocated);
+}
+TEST_CASE("Child_Process keeps queued writes intact", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  ug::Child_Process proc{opt, ctx};
+
+  std::string received;
+  proc.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.append(buf.begin(), buf.end());
+  });
+
+  // Bigger than a pipe, so each write is still queued when the next one
+  // comes in with a buffer the caller reuses.
+  std::string expected = "PpM";
+  ug::buf_t msg;
+  for(char c : {'a', 'b', 'c'})
+  {
+    msg.assign(200000, c);
+    proc.write(msg);
+    expected.append(msg.begin(), msg.end());
+  }
+  msg.assign(msg.size(), 'x');
+
+  for(int tries = 0; received.size() < expected.size() && tries < 100;
+      ++tries)
+  {
+    ctx.step(100);
+  }
+
+  REQUIRE(received.size() == expected.size());
+  CHECK(received == expected);
+}
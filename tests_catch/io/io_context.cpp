@@ -0,0 +1,131 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <unistd.h>
+#include <sys/wait.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "io/io_context.h"
+
+namespace
+{
+  char cat_name[] = "cat";
+  char* cat_args[] = {cat_name, NULL};
+}
+
+TEST_CASE("IO_Context services every child process at once", "[iolib]")
+{
+  constexpr std::size_t Process_Count = 4;
+
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  std::vector<std::unique_ptr<ug::Child_Process> > procs;
+  std::vector<std::string> lines(Process_Count);
+  for(std::size_t i = 0; i < Process_Count; ++i)
+  {
+    procs.push_back(std::make_unique<ug::Child_Process>(
+                      opt, ctx, ug::ipc::Framing::Lines));
+    procs.back()->set_read_callback([&lines, i](ug::buf_t const& buf)
+    {
+      lines[i].append(buf.begin(), buf.end());
+    });
+    procs.back()->write(ug::buf_from_string("Hello\n"));
+  }
+
+  auto all_read = [&]()
+  {
+    for(auto const& line : lines) if(line.empty()) return false;
+    return true;
+  };
+
+  // Stepping a process registered with a context doesn't do anything.
+  for(auto& proc : procs) proc->step();
+
+  for(int tries = 0; !all_read() && tries < 100; ++tries) ctx.step(100);
+
+  // cat echoes the handshake back at us too.
+  for(auto const& line : lines) CHECK(line == "PpMHello");
+
+  // The processes go away on a later step.
+  procs.clear();
+}
+TEST_CASE("Child_Process without a context runs its own loop", "[iolib]")
+{
+  ug::ipc::Spawn_Options opt;
+  opt.args = cat_args;
+  opt.cwd = NULL;
+
+  ug::Child_Process proc{opt, ug::ipc::Framing::Lines};
+
+  std::string line;
+  proc.set_read_callback([&](ug::buf_t const& buf)
+  {
+    line.append(buf.begin(), buf.end());
+  });
+  proc.write(ug::buf_from_string("Hello\n"));
+
+  for(int tries = 0; line.empty() && tries < 1000; ++tries)
+  {
+    usleep(1000);
+    proc.step();
+  }
+  CHECK(line == "PpMHello");
+}
+TEST_CASE("IO_Context services Shm_IO", "[iolib]")
+{
+  ug::IO_Context ctx;
+  ug::Shm_IO io{ug::Shm_IO::Default_Capacity, ctx};
+
+  auto sent = ug::buf_from_string("Hello");
+
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    // Echo the message back.
+    ug::Shm_IO plugin_io{io.fds()};
+    plugin_io.set_read_callback([&](ug::buf_t const& buf)
+    {
+      plugin_io.write(buf);
+    });
+    while(plugin_io.wait(200)) plugin_io.step();
+    _exit(0);
+  }
+
+  ug::buf_t received;
+  io.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.insert(received.end(), buf.begin(), buf.end());
+  });
+  io.write(sent);
+
+  for(int tries = 0; received.size() < sent.size() && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(received == sent);
+
+  // The plugin gives up once it doesn't hear from us for a while.
+  int status;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+}
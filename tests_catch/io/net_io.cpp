@@ -0,0 +1,163 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "common/buffer_pool.h"
+
+namespace
+{
+  // Plain socket on loopback to check what Net_IO actually sends.
+  struct Udp_Socket
+  {
+    Udp_Socket() noexcept
+    {
+      fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = 0;
+      bind(fd, (sockaddr*) &addr, sizeof(addr));
+
+      socklen_t len = sizeof(addr);
+      getsockname(fd, (sockaddr*) &addr, &len);
+      port = ntohs(addr.sin_port);
+    }
+    ~Udp_Socket() noexcept
+    {
+      close(fd);
+    }
+
+    // Empty on timeout.
+    ug::buf_t recv(int timeout) noexcept
+    {
+      pollfd p;
+      p.fd = fd;
+      p.events = POLLIN;
+      p.revents = 0;
+      if(poll(&p, 1, timeout) <= 0) return {};
+
+      ug::buf_t buf(65536);
+      auto n = ::recv(fd, buf.data(), buf.size(), 0);
+      buf.resize(n < 0 ? 0 : n);
+      return buf;
+    }
+
+    void send_to(uint16_t to_port, ug::buf_t const& buf) noexcept
+    {
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(to_port);
+      sendto(fd, buf.data(), buf.size(), 0, (sockaddr*) &addr, sizeof(addr));
+    }
+
+    int fd;
+    uint16_t port;
+  };
+
+  uint16_t free_port() noexcept
+  {
+    return Udp_Socket{}.port;
+  }
+
+  ug::buf_t datagram(std::size_t i) noexcept
+  {
+    ug::buf_t buf(1000 + i);
+    for(auto& c : buf) c = i;
+    return buf;
+  }
+}
+
+TEST_CASE("Net_IO keeps every datagram in flight intact", "[iolib]")
+{
+  constexpr std::size_t Datagram_Count = 32;
+
+  ug::IO_Context ctx;
+  Udp_Socket sock;
+
+  ug::Net_IO io{"127.0.0.1", 0, "127.0.0.1", sock.port, ctx};
+
+  auto burst = [&]()
+  {
+    // The same buffer is reused for every write, the way a plugin's output
+    // buffer is.
+    ug::buf_t buf;
+    for(std::size_t i = 0; i < Datagram_Count; ++i)
+    {
+      buf = datagram(i);
+      io.write(buf);
+    }
+    // Get anything that had to be queued out.
+    ctx.step();
+
+    for(std::size_t i = 0; i < Datagram_Count; ++i)
+    {
+      ctx.step();
+      if(sock.recv(1000) != datagram(i)) return false;
+    }
+    return true;
+  };
+
+  REQUIRE(burst());
+
+  auto allocated = ug::io_buffer_pool().stats().allocated;
+  REQUIRE(burst());
+  CHECK(ug::io_buffer_pool().stats().allocated == allocated);
+}
+TEST_CASE("Net_IO posts one datagram at a time", "[iolib]")
+{
+  // Few enough that the socket's receive buffer holds all of them.
+  constexpr std::size_t Datagram_Count = 50;
+
+  ug::IO_Context ctx;
+  Udp_Socket sock;
+
+  uint16_t port = free_port();
+  ug::Net_IO io{"127.0.0.1", port, "127.0.0.1", sock.port, ctx};
+
+  std::vector<ug::buf_t> received;
+  io.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.push_back(buf);
+  });
+
+  // They all arrive before we get to look, but still come out one by one.
+  for(std::size_t i = 0; i < Datagram_Count; ++i)
+  {
+    sock.send_to(port, datagram(i));
+  }
+
+  for(int tries = 0; received.size() < Datagram_Count && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+
+  REQUIRE(received.size() == Datagram_Count);
+  for(std::size_t i = 0; i < Datagram_Count; ++i)
+  {
+    CHECK(received[i] == datagram(i));
+  }
+}
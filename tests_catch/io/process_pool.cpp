@@ -0,0 +1,129 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "catch/catch.hpp"
+#include "io/process_pool.h"
+
+namespace
+{
+  // Takes a moment to start up like an interpreter would, says it's ready,
+  // then echoes everything, starting with the header.
+  char sh_name[] = "sh";
+  char sh_flag[] = "-c";
+  char sh_script[] = "sleep 0.2; printf PpM; exec cat";
+  char* plugin_args[] = {sh_name, sh_flag, sh_script, NULL};
+
+  // Says something else first, in the same write.
+  char noisy_script[] = "sleep 0.2; printf PxPPpM; exec cat";
+  char* noisy_args[] = {sh_name, sh_flag, noisy_script, NULL};
+
+  std::string claim_and_echo(ug::Process_Pool& pool, ug::IO_Context& ctx)
+  {
+    auto proc = pool.claim();
+    if(!proc) return "";
+
+    std::string echoed;
+    proc->set_read_callback([&echoed](ug::buf_t const& buf)
+    {
+      echoed.append(buf.begin(), buf.end());
+    });
+    proc->write(ug::buf_from_string("Hello"));
+    for(int tries = 0; echoed.size() < 8 && tries < 100; ++tries)
+    {
+      ctx.step(100);
+    }
+    // Anything else would come in by now.
+    ctx.step(50);
+    return echoed;
+  }
+}
+
+TEST_CASE("Process_Pool starts plugins ahead of time", "[iolib]")
+{
+  constexpr std::size_t Pool_Size = 4;
+
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = plugin_args;
+  opt.cwd = NULL;
+
+  ug::Process_Pool pool{opt, Pool_Size, ctx};
+  CHECK(pool.size() == Pool_Size);
+
+  // They all start up at once, so this takes about as long as one of them.
+  for(int tries = 0; pool.ready() < Pool_Size && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  REQUIRE(pool.ready() == Pool_Size);
+
+  auto proc = pool.claim();
+  REQUIRE(proc);
+  // Another one is on its way.
+  CHECK(pool.size() == Pool_Size);
+  CHECK(pool.ready() == Pool_Size - 1);
+
+  std::string echoed;
+  proc->set_read_callback([&echoed](ug::buf_t const& buf)
+  {
+    echoed.append(buf.begin(), buf.end());
+  });
+  proc->write(ug::buf_from_string("Hello"));
+
+  // Only once claimed does it get the header, the ready message isn't
+  // passed on.
+  for(int tries = 0; echoed.size() < 8 && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(echoed == "PpMHello");
+}
+TEST_CASE("Process_Pool waits for a plugin to get ready", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = plugin_args;
+  opt.cwd = NULL;
+
+  ug::Process_Pool pool{opt, 1, ctx};
+  CHECK(pool.ready() == 0);
+
+  // The ready message isn't mistaken for output.
+  CHECK(claim_and_echo(pool, ctx) == "PpMHello");
+  CHECK(pool.size() == 1);
+}
+TEST_CASE("Process_Pool finds the ready message after other output",
+          "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  ug::ipc::Spawn_Options opt;
+  opt.args = noisy_args;
+  opt.cwd = NULL;
+
+  ug::Process_Pool pool{opt, 1, ctx};
+  for(int tries = 0; pool.ready() < 1 && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(pool.ready() == 1);
+  CHECK(claim_and_echo(pool, ctx) == "PpMHello");
+}
@@ -0,0 +1,165 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "io/reliable_io.h"
+
+namespace
+{
+  // Loses every so many writes and sends some twice, like a bad network.
+  struct Lossy_IO : public ug::External_IO
+  {
+    Lossy_IO(std::unique_ptr<ug::External_IO> io, std::size_t drop_every,
+             std::size_t duplicate_every) noexcept
+      : io_(std::move(io)), drop_every_(drop_every),
+        duplicate_every_(duplicate_every)
+    {
+      io_->set_read_callback([this](ug::buf_t const& buf) { post(buf); });
+    }
+
+    void write(ug::buf_t const& buf) noexcept override
+    {
+      ++writes_;
+      if(drop_every_ && writes_ % drop_every_ == 0) return;
+      io_->write(buf);
+      if(duplicate_every_ && writes_ % duplicate_every_ == 0) io_->write(buf);
+    }
+    void step() noexcept override
+    {
+      io_->step();
+    }
+  private:
+    std::unique_ptr<ug::External_IO> io_;
+    std::size_t drop_every_;
+    std::size_t duplicate_every_;
+    std::size_t writes_ = 0;
+  };
+
+  uint16_t free_port() noexcept
+  {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (sockaddr*) &addr, sizeof(addr));
+
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*) &addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+  }
+
+  ug::buf_t message(std::size_t i) noexcept
+  {
+    // Every fifth message needs a few datagrams.
+    ug::buf_t buf(i % 5 == 0 ? 5000 + i : 10 + i);
+    for(std::size_t j = 0; j < buf.size(); ++j) buf[j] = i + j;
+    return buf;
+  }
+
+  std::unique_ptr<ug::Reliable_IO>
+  make_lossy_end(ug::IO_Context& ctx, uint16_t bind_port, uint16_t to_port,
+                 std::size_t drop_every, std::size_t duplicate_every) noexcept
+  {
+    auto net = std::make_unique<ug::Net_IO>("127.0.0.1", bind_port,
+                                            "127.0.0.1", to_port, ctx);
+    auto lossy = std::make_unique<Lossy_IO>(std::move(net), drop_every,
+                                            duplicate_every);
+
+    ug::Reliable_Options opts;
+    opts.retransmit_timeout = std::chrono::milliseconds(10);
+    return std::make_unique<ug::Reliable_IO>(std::move(lossy), opts);
+  }
+}
+
+TEST_CASE("Reliable_IO delivers every message in order despite loss",
+          "[iolib]")
+{
+  constexpr std::size_t Message_Count = 200;
+
+  ug::IO_Context ctx;
+
+  uint16_t a_port = free_port();
+  uint16_t b_port = free_port();
+  auto a = make_lossy_end(ctx, a_port, b_port, 3, 7);
+  auto b = make_lossy_end(ctx, b_port, a_port, 4, 0);
+
+  std::vector<ug::buf_t> received;
+  b->set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.push_back(buf);
+  });
+
+  for(std::size_t i = 0; i < Message_Count; ++i) a->write(message(i));
+
+  for(int tries = 0; tries < 2000; ++tries)
+  {
+    if(received.size() == Message_Count && a->idle()) break;
+
+    ctx.step(5);
+    a->step();
+    b->step();
+  }
+
+  REQUIRE(received.size() == Message_Count);
+  for(std::size_t i = 0; i < Message_Count; ++i)
+  {
+    CHECK(received[i] == message(i));
+  }
+  CHECK(a->idle());
+
+  // Some of those had to be sent again, and some arrived twice.
+  CHECK(a->stats().retransmits > 0);
+  CHECK(b->stats().duplicates > 0);
+}
+TEST_CASE("Reliable_IO works both ways at once", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  uint16_t a_port = free_port();
+  uint16_t b_port = free_port();
+  auto a = make_lossy_end(ctx, a_port, b_port, 5, 0);
+  auto b = make_lossy_end(ctx, b_port, a_port, 5, 0);
+
+  // b echoes everything back.
+  b->set_read_callback([&](ug::buf_t const& buf) { b->write(buf); });
+
+  std::vector<ug::buf_t> received;
+  a->set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.push_back(buf);
+  });
+
+  for(std::size_t i = 0; i < 50; ++i) a->write(message(i));
+
+  for(int tries = 0; received.size() < 50 && tries < 2000; ++tries)
+  {
+    ctx.step(5);
+    a->step();
+    b->step();
+  }
+
+  REQUIRE(received.size() == 50);
+  for(std::size_t i = 0; i < 50; ++i) CHECK(received[i] == message(i));
+}
@@ -0,0 +1,274 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "rpc/plugins.h"
+
+namespace
+{
+  // Runs in a forked process. Attaches to the channel like a spawned plugin
+  // would and writes back every byte it reads until it has seen total.
+  void echo_plugin(ug::shm::Channel_Fds fds, std::size_t total) noexcept
+  {
+    ug::Shm_IO io{fds};
+
+    std::size_t received = 0;
+    io.set_read_callback([&](ug::buf_t const& buf)
+    {
+      received += buf.size();
+      io.write(buf);
+    });
+
+    while(received < total || io.pending())
+    {
+      io.step();
+      io.wait(100);
+    }
+    _exit(0);
+  }
+
+  // Runs in a forked process. Reads total bytes and writes one back.
+  void sink_plugin(ug::shm::Channel_Fds fds, std::size_t total) noexcept
+  {
+    ug::Shm_IO io{fds};
+
+    std::size_t received = 0;
+    io.set_read_callback([&](ug::buf_t const& buf)
+    {
+      received += buf.size();
+    });
+
+    while(received < total)
+    {
+      io.step();
+      if(received < total) io.wait(100);
+    }
+
+    io.write(ug::buf_t(1, 0));
+    _exit(0);
+  }
+
+  bool exited_cleanly(pid_t pid) noexcept
+  {
+    int status;
+    if(waitpid(pid, &status, 0) != pid) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+}
+
+TEST_CASE("Shm_IO talks to another process", "[iolib]")
+{
+  auto io = std::make_unique<ug::Shm_IO>();
+  auto& shm_io = *io;
+
+  // Json: [2, ["Hello"], 1]
+  using namespace ug::literals;
+  auto frame = "\x93\x02\x91\xa5\x48\x65\x6c\x6c\x6f\x01"_buf;
+  constexpr std::size_t Request_Count = 3;
+
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0) echo_plugin(shm_io.fds(), frame.size() * Request_Count);
+
+  // Msgpack_Plugin doesn't need to know where the bytes come from.
+  ug::Msgpack_Plugin plugin{std::move(io)};
+
+  ug::Request req;
+  req.fn = 2;
+  req.params = ug::make_params("Hello");
+  for(std::size_t i = 0; i < Request_Count; ++i)
+  {
+    req.id = 1;
+    plugin.post_request(req);
+  }
+  plugin.flush();
+
+  std::vector<ug::Request> reqs;
+  for(int tries = 0; reqs.size() < Request_Count && tries < 100; ++tries)
+  {
+    shm_io.wait(100);
+    plugin.poll_requests(reqs, Request_Count);
+  }
+
+  REQUIRE(reqs.size() == Request_Count);
+  for(auto const& echoed : reqs)
+  {
+    CHECK(echoed.fn == 2);
+    REQUIRE(echoed.id);
+    CHECK(*echoed.id == 1);
+    REQUIRE(echoed.params);
+    CHECK(std::get<0>(echoed.params->object.get()
+                      .as<std::tuple<std::string> >()) == "Hello");
+  }
+
+  CHECK(exited_cleanly(pid));
+}
+TEST_CASE("Shm_IO writes more than fits in the ring", "[iolib]")
+{
+  ug::Shm_IO io{4096};
+  REQUIRE(io.fds().capacity == 4096);
+
+  ug::buf_t sent(io.fds().capacity * 5 + 123);
+  for(std::size_t i = 0; i < sent.size(); ++i) sent[i] = i * 7;
+
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0) echo_plugin(io.fds(), sent.size());
+
+  ug::buf_t received;
+  io.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.insert(received.end(), buf.begin(), buf.end());
+  });
+
+  // Most of it has to wait for the plugin to catch up.
+  io.write(sent);
+  CHECK(io.pending() > 0);
+
+  for(int tries = 0; received.size() < sent.size() && tries < 1000; ++tries)
+  {
+    io.step();
+    io.wait(100);
+  }
+
+  CHECK(io.pending() == 0);
+  REQUIRE(received.size() == sent.size());
+  CHECK(received == sent);
+
+  CHECK(exited_cleanly(pid));
+}
+
+TEST_CASE("Shm_IO throughput against a pipe", "[.][benchmark][iolib]")
+{
+  using clock_t = std::chrono::steady_clock;
+
+  constexpr std::size_t Message_Size = 4096;
+  constexpr std::size_t Total = 512 * 1024 * 1024;
+
+  ug::buf_t msg(Message_Size, 0x42);
+
+  // Shared memory.
+  ug::Shm_IO io;
+
+  auto start = clock_t::now();
+
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0) sink_plugin(io.fds(), Total);
+
+  bool done = false;
+  io.set_read_callback([&](ug::buf_t const&) { done = true; });
+
+  for(std::size_t sent = 0; sent < Total; sent += Message_Size)
+  {
+    io.write(msg);
+    while(io.pending()) io.wait(100);
+  }
+  while(!done)
+  {
+    io.step();
+    if(!done) io.wait(100);
+  }
+
+  std::chrono::duration<double> shm_time = clock_t::now() - start;
+  CHECK(exited_cleanly(pid));
+
+  // Plain pipes, which is what Child_Process boils down to.
+  int to_child[2], to_parent[2];
+  REQUIRE(pipe(to_child) == 0);
+  REQUIRE(pipe(to_parent) == 0);
+
+  start = clock_t::now();
+
+  pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    ug::buf_t buf(Message_Size);
+    std::size_t received = 0;
+    while(received < Total)
+    {
+      auto n = read(to_child[0], buf.data(), buf.size());
+      if(n <= 0) _exit(1);
+      received += n;
+    }
+    if(write(to_parent[1], buf.data(), 1) != 1) _exit(1);
+    _exit(0);
+  }
+
+  std::size_t sent = 0;
+  while(sent < Total && write(to_child[1], msg.data(), msg.size()) > 0)
+  {
+    sent += Message_Size;
+  }
+  REQUIRE(sent == Total);
+  REQUIRE(read(to_parent[0], msg.data(), 1) == 1);
+
+  std::chrono::duration<double> pipe_time = clock_t::now() - start;
+  CHECK(exited_cleanly(pid));
+
+  for(int fd : {to_child[0], to_child[1], to_parent[0], to_parent[1]})
+  {
+    close(fd);
+  }
+
+  auto mib = Total / (1024.0 * 1024.0);
+  WARN("Sending " << mib << " MiB in " << Message_Size << " byte writes, "
+       << "shm: " << mib / shm_time.count() << " MiB/s, "
+       << "pipe: " << mib / pipe_time.count() << " MiB/s");
+}
+TEST_CASE("Shm_IO gives up on a ring the other side broke", "[iolib]")
+{
+  ug::Shm_IO io{4096};
+  std::size_t received = 0;
+  io.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received += buf.size();
+  });
+
+  // Attach the way a plugin would, then claim to have written far more than
+  // the ring holds.
+  ug::shm::Channel_Fds fds = io.fds();
+  fds.mem_fd = dup(fds.mem_fd);
+  fds.host_event_fd = dup(fds.host_event_fd);
+  fds.plugin_event_fd = dup(fds.plugin_event_fd);
+  ug::shm::Channel* plugin = ug::shm::open_channel(fds);
+
+  plugin->tx.header->tail.store(1 << 20);
+  io.step();
+  CHECK_FALSE(io.open());
+  CHECK(received == 0);
+
+  // Or read more than was written.
+  ug::shm::Channel* host = ug::shm::create_channel(4096);
+  host->tx.header->head.store(100);
+  ug::buf_t data(10, 'x');
+  CHECK(ug::shm::write(*host, data.data(), data.size()) == 0);
+  CHECK(host->broken);
+
+  io.write(data);
+  CHECK(io.pending() == 0);
+
+  ug::shm::delete_channel(host);
+  ug::shm::delete_channel(plugin);
+}
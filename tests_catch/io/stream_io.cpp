@@ -0,0 +1,186 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fstream>
+#include <unistd.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "io/io_context.h"
+
+namespace
+{
+  // Connects a few plugins to the listener and has each of them echo back a
+  // greeting, all on the listener's context.
+  bool echo_through(ug::net::Endpoint const& listen_at,
+                    ug::net::Endpoint connect_to)
+  {
+    constexpr std::size_t Plugin_Count = 4;
+
+    ug::IO_Context ctx;
+
+    std::vector<std::unique_ptr<ug::Stream_IO> > accepted;
+    ug::Stream_Listener listener{listen_at, ctx,
+    [&](std::unique_ptr<ug::Stream_IO> io)
+    {
+      ug::Stream_IO* engine_side = io.get();
+      io->set_read_callback([engine_side](ug::buf_t const& buf)
+      {
+        engine_side->write(buf);
+      });
+      accepted.push_back(std::move(io));
+    }};
+    if(connect_to.kind == ug::net::Stream_Kind::Tcp)
+    {
+      connect_to.port = listener.port();
+    }
+
+    std::vector<std::unique_ptr<ug::Stream_IO> > plugins;
+    std::vector<std::string> echoed(Plugin_Count);
+    for(std::size_t i = 0; i < Plugin_Count; ++i)
+    {
+      plugins.push_back(std::make_unique<ug::Stream_IO>(connect_to, ctx));
+      plugins.back()->set_read_callback([&echoed, i](ug::buf_t const& buf)
+      {
+        echoed[i].append(buf.begin(), buf.end());
+      });
+      // Written before the connection is even up.
+      plugins.back()->write(ug::buf_from_string("PpM" + std::to_string(i)));
+    }
+
+    auto all_echoed = [&]()
+    {
+      for(std::size_t i = 0; i < Plugin_Count; ++i)
+      {
+        if(echoed[i] != "PpM" + std::to_string(i)) return false;
+      }
+      return true;
+    };
+    for(int tries = 0; !all_echoed() && tries < 100; ++tries)
+    {
+      ctx.step(100);
+    }
+
+    bool ok = all_echoed() && accepted.size() == Plugin_Count;
+
+    // Let the closed handles go before the context does.
+    plugins.clear();
+    accepted.clear();
+    ctx.step();
+    return ok;
+  }
+}
+
+TEST_CASE("Stream_Listener multiplexes TCP plugins on one context", "[iolib]")
+{
+  REQUIRE(echo_through(ug::net::tcp_endpoint("127.0.0.1", 0),
+                       ug::net::tcp_endpoint("127.0.0.1", 0)));
+}
+TEST_CASE("Stream_Listener multiplexes Unix plugins on one context",
+          "[iolib]")
+{
+  std::string path = "/tmp/ug_stream_io_" + std::to_string(getpid());
+  REQUIRE(echo_through(ug::net::unix_endpoint(path),
+                       ug::net::unix_endpoint(path)));
+}
+TEST_CASE("Stream_IO notices when a plugin hangs up", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  std::unique_ptr<ug::Stream_IO> engine_side;
+  ug::Stream_Listener listener{ug::net::tcp_endpoint("127.0.0.1", 0), ctx,
+  [&](std::unique_ptr<ug::Stream_IO> io)
+  {
+    engine_side = std::move(io);
+  }};
+
+  auto plugin = std::make_unique<ug::Stream_IO>(
+    ug::net::tcp_endpoint("127.0.0.1", listener.port()), ctx);
+  for(int tries = 0; !engine_side && tries < 100; ++tries) ctx.step(100);
+  REQUIRE(engine_side);
+  CHECK(engine_side->open());
+
+  plugin.reset();
+  for(int tries = 0; engine_side->open() && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK_FALSE(engine_side->open());
+
+  engine_side.reset();
+  ctx.step();
+}
+TEST_CASE("Stream_IO reads straight into the consumer's buffer", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  std::unique_ptr<ug::Stream_IO> engine_side;
+  ug::Stream_Listener listener{ug::net::tcp_endpoint("127.0.0.1", 0), ctx,
+  [&](std::unique_ptr<ug::Stream_IO> io)
+  {
+    engine_side = std::move(io);
+  }};
+
+  ug::Stream_IO plugin{ug::net::tcp_endpoint("127.0.0.1", listener.port()),
+                       ctx};
+  for(int tries = 0; !engine_side && tries < 100; ++tries) ctx.step(100);
+  REQUIRE(engine_side);
+
+  ug::buf_t dest;
+  std::string received;
+  bool copied = false;
+  engine_side->set_dest_callback([&dest](std::size_t size)
+  {
+    dest.resize(size);
+    return dest.data();
+  });
+  engine_side->set_view_callback([&](ug::Buf_View buf)
+  {
+    if(buf.data() != dest.data()) copied = true;
+    received.append(buf.begin(), buf.end());
+  });
+
+  plugin.write(ug::buf_from_string("Hello"));
+  for(int tries = 0; received.size() < 5 && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(received == "Hello");
+  CHECK_FALSE(copied);
+
+  engine_side.reset();
+  ctx.step();
+}
+TEST_CASE("Stream_Listener leaves files that aren't sockets alone",
+          "[iolib]")
+{
+  std::string path = "/tmp/ug_not_a_socket_" + std::to_string(getpid());
+  std::ofstream{path} << "Keep me";
+
+  ug::IO_Context ctx;
+  auto accept = [](std::unique_ptr<ug::Stream_IO>) {};
+  CHECK_THROWS_AS(ug::Stream_Listener(ug::net::unix_endpoint(path), ctx,
+                                      accept),
+                  ug::net::Bind_Error);
+  ctx.step();
+
+  std::string contents;
+  std::getline(std::ifstream{path}, contents);
+  CHECK(contents == "Keep me");
+  unlink(path.c_str());
+}
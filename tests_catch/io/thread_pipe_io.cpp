@@ -0,0 +1,70 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+
+TEST_CASE("Thread_Pipe_IO moves buffers across threads in order", "[iolib]")
+{
+  constexpr std::size_t Buffer_Count = 10000;
+
+  // Small enough that the writer has to hold on to some of its buffers.
+  ug::Thread_Pipe_IO engine_side{16};
+  auto& plugin_side = engine_side.counterpart();
+
+  std::vector<std::size_t> received;
+  engine_side.set_read_callback([&received](ug::buf_t const& buf)
+  {
+    std::size_t i;
+    std::memcpy(&i, buf.data(), sizeof(i));
+    received.push_back(i);
+  });
+
+  std::atomic<bool> done{false};
+  std::thread plugin{[&plugin_side, &done]()
+  {
+    plugin_side.set_read_callback([](ug::buf_t const&) {});
+    for(std::size_t i = 0; i < Buffer_Count; ++i)
+    {
+      ug::buf_t buf(sizeof(i));
+      std::memcpy(buf.data(), &i, sizeof(i));
+      plugin_side.write(std::move(buf));
+    }
+    // Get the rest out as the engine makes room.
+    while(!done)
+    {
+      plugin_side.step();
+      std::this_thread::yield();
+    }
+  }};
+
+  while(received.size() < Buffer_Count)
+  {
+    engine_side.step();
+    std::this_thread::yield();
+  }
+  done = true;
+  plugin.join();
+
+  REQUIRE(received.size() == Buffer_Count);
+  for(std::size_t i = 0; i < Buffer_Count; ++i) REQUIRE(received[i] == i);
+}
@@ -0,0 +1,258 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "io/io_context.h"
+#include "io/uring.h"
+
+TEST_CASE("Uring_IO echoes over sockets with one submission per step",
+          "[iolib]")
+{
+  constexpr std::size_t Plugin_Count = 8;
+
+  ug::IO_Context ctx;
+  if(!ctx.uring())
+  {
+    WARN("io_uring isn't available, skipping");
+    return;
+  }
+
+  std::vector<std::unique_ptr<ug::Uring_IO> > engine_side;
+  std::vector<std::unique_ptr<ug::Uring_IO> > plugins;
+  std::vector<std::string> echoed(Plugin_Count);
+  for(std::size_t i = 0; i < Plugin_Count; ++i)
+  {
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    engine_side.push_back(std::make_unique<ug::Uring_IO>(fds[0], ctx));
+    ug::Uring_IO* engine = engine_side.back().get();
+    engine->set_read_callback([engine](ug::buf_t const& buf)
+    {
+      engine->write(buf);
+    });
+
+    plugins.push_back(std::make_unique<ug::Uring_IO>(fds[1], ctx));
+    plugins.back()->set_read_callback([&echoed, i](ug::buf_t const& buf)
+    {
+      echoed[i].append(buf.begin(), buf.end());
+    });
+    plugins.back()->write(ug::buf_from_string("PpM" + std::to_string(i)));
+  }
+
+  // Every read and write so far goes to the kernel at once.
+  auto enters = ug::uring::stats(*ctx.uring()).enters;
+  ctx.step();
+  CHECK(ug::uring::stats(*ctx.uring()).enters == enters + 1);
+
+  auto all_echoed = [&]()
+  {
+    for(std::size_t i = 0; i < Plugin_Count; ++i)
+    {
+      if(echoed[i] != "PpM" + std::to_string(i)) return false;
+    }
+    return true;
+  };
+  for(int tries = 0; !all_echoed() && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(all_echoed());
+
+  // Hanging up is noticed by the other side.
+  plugins.clear();
+  for(int tries = 0; engine_side[0]->open() && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK_FALSE(engine_side[0]->open());
+
+  engine_side.clear();
+  ctx.step();
+}
+TEST_CASE("Uring_IO reads and writes pipes", "[iolib]")
+{
+  ug::IO_Context ctx;
+  if(!ctx.uring())
+  {
+    WARN("io_uring isn't available, skipping");
+    return;
+  }
+
+  int to_us[2];
+  int from_us[2];
+  REQUIRE(pipe(to_us) == 0);
+  REQUIRE(pipe(from_us) == 0);
+  fcntl(from_us[0], F_SETFL, O_NONBLOCK);
+
+  std::string received;
+  ug::Uring_IO in{to_us[0], ctx};
+  in.set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.append(buf.begin(), buf.end());
+  });
+  ug::Uring_IO out{from_us[1], ctx};
+
+  // Bigger than a registered buffer.
+  std::string big(100 * 1024, 'x');
+  out.write(ug::buf_from_string("Hello"));
+  out.write(ug::buf_from_string(big));
+  REQUIRE(write(to_us[1], "World", 5) == 5);
+
+  std::string sent;
+  for(int tries = 0; (received.size() < 5 || sent.size() < 5 + big.size()) &&
+                     tries < 100; ++tries)
+  {
+    ctx.step(10);
+
+    char buf[4096];
+    ssize_t got;
+    while(sent.size() < 5 + big.size() &&
+          (got = read(from_us[0], buf, sizeof(buf))) > 0)
+    {
+      sent.append(buf, got);
+    }
+  }
+  CHECK(received == "World");
+  CHECK(sent == "Hello" + big);
+
+  close(to_us[1]);
+  close(from_us[0]);
+}
+TEST_CASE("Uring_IO closes its fd when there's no ring", "[iolib]")
+{
+  ug::IO_Context ctx;
+  if(ctx.uring()) return;
+
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  CHECK_THROWS_AS(ug::Uring_IO(fds[0], ctx), ug::uring::Setup_Error);
+  CHECK(fcntl(fds[0], F_GETFD) == -1);
+  close(fds[1]);
+}
+TEST_CASE("make_fd_io works with or without io_uring", "[iolib]")
+{
+  ug::IO_Context ctx;
+
+  int fds[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  std::string received;
+  auto a = ug::make_fd_io(fds[0], ctx);
+  auto b = ug::make_fd_io(fds[1], ctx);
+  b->set_read_callback([&](ug::buf_t const& buf)
+  {
+    received.append(buf.begin(), buf.end());
+  });
+
+  a->write(ug::buf_from_string("PpM"));
+  for(int tries = 0; received.size() < 3 && tries < 100; ++tries)
+  {
+    ctx.step(100);
+  }
+  CHECK(received == "PpM");
+
+  a.reset();
+  b.reset();
+  ctx.step();
+}
+TEST_CASE("Short writes wait for room in a full submission queue",
+          "[iolib]")
+{
+  ug::IO_Context ctx;
+  if(!ctx.uring())
+  {
+    WARN("io_uring isn't available, skipping");
+    return;
+  }
+  // Two entries are easy to fill.
+  ug::uring::Ring* ring = ug::uring::create_ring(ctx.loop(), 2);
+
+  // Only a page fits in the pipe, so a bigger write comes back short.
+  int out[2];
+  int idle[2];
+  REQUIRE(pipe(out) == 0);
+  REQUIRE(pipe(idle) == 0);
+  REQUIRE(fcntl(out[1], F_SETPIPE_SZ, 4096) == 4096);
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  fcntl(out[1], F_SETFL, O_NONBLOCK);
+
+  std::vector<int> results;
+  auto on_write = [](ug::uring::Op* op, int res, ug::Buf_View)
+  {
+    ((std::vector<int>*) op->user_data)->push_back(res);
+  };
+  auto ignore = [](ug::uring::Op*, int, ug::Buf_View) {};
+  ug::uring::Op* writer = ug::uring::create_op(&results, on_write);
+  ug::uring::Op* readers[] = {ug::uring::create_op(nullptr, ignore),
+                              ug::uring::create_op(nullptr, ignore)};
+
+  std::string data(3 * 4096, 'x');
+  REQUIRE(ug::uring::write(*ring, *writer, out[1], ug::buf_from_string(data)));
+  ug::uring::submit(*ring);
+
+  // The rest of the write has nowhere to go when the first part completes.
+  ug::uring::hold_submissions(*ring, true);
+  for(auto* reader : readers)
+  {
+    REQUIRE(ug::uring::read(*ring, *reader, idle[0], 16));
+  }
+  ug::uring::Op* extra = ug::uring::create_op(nullptr, ignore);
+  CHECK_FALSE(ug::uring::read(*ring, *extra, idle[0], 16));
+  ug::uring::release_op(*ring, extra);
+
+  std::string received;
+  auto drain = [&]()
+  {
+    char buf[4096];
+    ssize_t got;
+    while((got = read(out[0], buf, sizeof(buf))) > 0) received.append(buf, got);
+  };
+  // Whatever the kernel got is written, then nothing else.
+  for(int tries = 0; tries < 20; ++tries)
+  {
+    drain();
+    ctx.step(10);
+  }
+  CHECK(received.size() < data.size());
+  CHECK(writer->in_flight);
+  CHECK(results.empty());
+
+  ug::uring::hold_submissions(*ring, false);
+  for(int tries = 0; received.size() < data.size() && tries < 100; ++tries)
+  {
+    drain();
+    ctx.step(10);
+  }
+  CHECK(received == data);
+  REQUIRE(results.size() == 1);
+  CHECK(results[0] > 0);
+  CHECK_FALSE(writer->in_flight);
+
+  ug::uring::release_op(*ring, writer);
+  for(auto* reader : readers) ug::uring::release_op(*ring, reader);
+  ug::uring::delete_ring(ring);
+  ctx.step();
+
+  for(int fd : {out[0], out[1], idle[0], idle[1]}) close(fd);
+}
@@ -0,0 +1,74 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "catch/catch.hpp"
+#include "rpc/direct_plugin.h"
+#include "common/vector.h"
+
+TEST_CASE("Direct methods skip msgpack", "[rpclib]")
+{
+  ug::Req_Dispatcher dispatch;
+
+  auto fn0 = dispatch.add_method<ug::Vec<int>, std::string>("Test.Error",
+  [](ug::Vec<int> v, std::string const& str) -> ug::response_result<bool>
+  {
+    if(str.empty()) return true;
+    return ug::Error_Response{v.x + v.y, str};
+  });
+  auto fn1 = dispatch.add_method<>("Test.Zero", []() { return 0; });
+
+  auto error = dispatch.direct_method<bool, ug::Vec<int>, std::string>(fn0);
+  REQUIRE(error);
+  CHECK(boost::get<bool>(error({1, 2}, "")));
+
+  auto res = error({1, 2}, "Oops");
+  ug::Error_Response const* err = boost::get<ug::Error_Response>(&res);
+  REQUIRE(err);
+  CHECK(err->code == 3);
+  CHECK(err->msg == "Oops");
+
+  auto zero = dispatch.direct_method<int>(fn1);
+  REQUIRE(zero);
+  CHECK(boost::get<int>(zero()) == 0);
+
+  // The signature has to match exactly.
+  CHECK_FALSE(dispatch.direct_method<bool>(fn1));
+  CHECK_FALSE((dispatch.direct_method<int, int>(fn1)));
+  CHECK_FALSE(dispatch.direct_method<int>(fn1 + 1));
+}
+TEST_CASE("Direct plugins call methods from a shared library", "[rpclib]")
+{
+  int sum = 0;
+
+  ug::Req_Dispatcher dispatch;
+  dispatch.add_method<int>("Test.Add", [&sum](int i)
+  {
+    return sum += i;
+  });
+
+  {
+    ug::Direct_Plugin plugin{UG_DIRECT_TEST_PLUGIN, dispatch};
+    plugin.step();
+    plugin.step();
+  }
+  CHECK(sum == 4);
+
+  CHECK_THROWS_AS(ug::Direct_Plugin("no_such_plugin.so", dispatch),
+                  ug::Plugin_Load_Error);
+}
@@ -0,0 +1,49 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rpc/direct_plugin.h"
+
+namespace
+{
+  struct State
+  {
+    ug::Direct_Method<int, int> add;
+  };
+}
+
+UG_DIRECT_PLUGIN_ABI()
+
+UG_DIRECT_PLUGIN void* ug_plugin_start(ug::Direct_Host* host)
+{
+  auto fn = host->dispatcher->method_id("Test.Add");
+  if(!fn) return nullptr;
+
+  State* state = new State;
+  state->add = host->dispatcher->direct_method<int, int>(*fn);
+  return state;
+}
+UG_DIRECT_PLUGIN void ug_plugin_step(void* s)
+{
+  State* state = (State*) s;
+  if(state && state->add) state->add(2);
+}
+UG_DIRECT_PLUGIN void ug_plugin_stop(void* s)
+{
+  delete (State*) s;
+}
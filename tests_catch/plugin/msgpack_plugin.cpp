@@ -18,11 +18,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 //#include <boost/optional/optional_io.hpp>
+#include <stdexcept>
 #include "catch/catch.hpp"
 #include "io/external_io.h"
 #include "rpc/plugins.h"
 #include "rpc/dispatch.h"
 #include "common/utility.h"
+#include "common/vector.h"
 
 TEST_CASE("Msgpack plugin poll_request", "[rpclib]")
 {
@@ -94,6 +96,67 @@ TEST_CASE("Msgpack plugin poll_request", "[rpclib]")
   CHECK(req.id);
   CHECK_FALSE(req.params);
 }
+namespace
+{
+  struct Step_Counting_Pipe_IO : public ug::Pipe_IO
+  {
+    void step() noexcept override
+    {
+      ++steps;
+      Pipe_IO::step();
+    }
+    int steps = 0;
+  };
+}
+TEST_CASE("Msgpack plugin poll_requests", "[rpclib]")
+{
+  auto out_pipe = std::make_unique<Step_Counting_Pipe_IO>();
+  auto& write_pipe = out_pipe->counterpart();
+  auto& steps = out_pipe->steps;
+
+  ug::Msgpack_Plugin plugin{std::move(out_pipe)};
+
+  using namespace ug::literals;
+
+  // Json: [0]
+  write_pipe.write("\x91\x00"_buf);
+
+  // Json: "bad"
+  write_pipe.write("\xa3\x62\x61\x64"_buf);
+
+  // Json: [2, ["Hello"], 1]
+  write_pipe.write("\x93\x02\x91\xa5\x48\x65\x6c\x6c\x6f\x01"_buf);
+
+  // Json: [3, 2]
+  write_pipe.write("\x92\x03\x02"_buf);
+
+  std::vector<ug::Request> reqs;
+
+  // Only take two, the bad request shouldn't count.
+  REQUIRE(plugin.poll_requests(reqs, 2) == 2);
+  CHECK(steps == 1);
+
+  CHECK(reqs[0].fn == 0);
+  CHECK_FALSE(reqs[0].id);
+  CHECK_FALSE(reqs[0].params);
+
+  CHECK(reqs[1].fn == 2);
+  CHECK(reqs[1].id);
+  REQUIRE(reqs[1].params);
+  REQUIRE(reqs[1].params->object.get().type == msgpack::type::ARRAY);
+  REQUIRE(reqs[1].params->object.get().via.array.size == 1);
+
+  // The rest of them.
+  REQUIRE(plugin.poll_requests(reqs) == 1);
+  CHECK(steps == 2);
+  CHECK(reqs[0].fn == 3);
+  CHECK(reqs[0].id);
+  CHECK_FALSE(reqs[0].params);
+
+  // Nothing left, the batch should be empty.
+  CHECK(plugin.poll_requests(reqs) == 0);
+  CHECK(reqs.empty());
+}
 TEST_CASE("Msgpack plugin post_request", "[rpclib]")
 {
   auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
@@ -110,8 +173,12 @@ TEST_CASE("Msgpack plugin post_request", "[rpclib]")
     }
   });
 
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
   auto read_bytes = [&](size_t count) -> std::vector<ug::uchar>
   {
+    // Responses are buffered until the plugin is flushed.
+    plugin.flush();
     read_pipe.step();
 
     REQUIRE(where + count <= buf_recieved_.size());
@@ -125,8 +192,6 @@ TEST_CASE("Msgpack plugin post_request", "[rpclib]")
 
   using namespace ug::literals;
 
-  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
-
   // [0]
   ug::Request req;
   req.fn = 0;
@@ -174,28 +239,379 @@ TEST_CASE("Request dispatcher", "[rpclib]")
   int var0 = 0;
   int var1 = 0;
 
-  auto func0 = [&var0](auto* run_context, auto& params)
+  ug::Req_Dispatcher dispatch;
+
+  auto fn0 = dispatch.add_method<int>("Test.Set", [&var0](int i)
   {
-    var0 = 5;
-  };
-  auto func1 = [&var1](auto* run_context, auto& params)
+    var0 = i;
+    return ug::make_params(true);
+  });
+  auto fn1 = dispatch.add_method<>("Test.Increment", [&var1]()
+  {
+    return ++var1;
+  });
+  auto fn2 = dispatch.add_method<ug::Vec<int>, std::string>("Test.Error",
+  [](ug::Vec<int> v, std::string const& str) -> ug::response_result<bool>
+  {
+    if(str.empty()) return true;
+    return ug::Error_Response{v.x + v.y, str};
+  });
+
+  CHECK(fn0 == 0);
+  CHECK(fn1 == 1);
+  CHECK(fn2 == 2);
+  REQUIRE(dispatch.method_id("Test.Increment"));
+  CHECK(*dispatch.method_id("Test.Increment") == fn1);
+  CHECK_FALSE(dispatch.method_id("Test.Nothing"));
+
+  // Responses are packed into here.
+  ug::buf_t out;
+  auto unpack_response = [&out]()
   {
-    ++var1;
+    auto res = msgpack::unpack(reinterpret_cast<char const*>(out.data()),
+                               out.size());
+    out.clear();
+    return res;
   };
 
-  std::vector<ug::method_t> methods{func0, func1};
+  using res_t = std::tuple<ug::fn_t, std::tuple<int>, ug::id_t>;
+  using err_t = std::tuple<ug::fn_t, std::tuple<int, std::string>, ug::id_t,
+                           bool>;
 
   auto in = 5;
   ug::Request req;
-  req.fn = 0;
-  req.params = ug::make_params(5);
-  ug::dispatch(methods, req);
+  req.fn = fn0;
+  req.params = ug::make_params(in);
+  dispatch.dispatch(req);
   REQUIRE(var0 == in);
+  CHECK(out.empty());
 
-  req.fn = 1;
+  req.fn = fn1;
   req.params = boost::none;
 
-  ug::dispatch(methods, req);
-  ug::dispatch(methods, req);
+  ug::Run_Context ctx{out, fn1, 7};
+  dispatch.dispatch(req);
+  dispatch.dispatch(req, &ctx);
   REQUIRE(var1 == 2);
+  CHECK_FALSE(ctx.is_error);
+  CHECK(unpack_response().get().as<res_t>() == res_t(fn1, 2, 7));
+
+  req.fn = fn2;
+  req.params = ug::make_params(ug::Vec<int>{1, 2}, "");
+  ctx = ug::Run_Context{out, fn2, 8};
+  dispatch.dispatch(req, &ctx);
+  CHECK_FALSE(ctx.is_error);
+  using bool_res_t = std::tuple<ug::fn_t, std::tuple<bool>, ug::id_t>;
+  CHECK(unpack_response().get().as<bool_res_t>() ==
+        bool_res_t(fn2, std::make_tuple(true), 8));
+
+  req.params = ug::make_params(ug::Vec<int>{1, 2}, "Hello");
+  dispatch.dispatch(req, &ctx);
+  CHECK(ctx.is_error);
+  CHECK(unpack_response().get().as<err_t>() ==
+        err_t(fn2, std::make_tuple(3, "Hello"), 8, true));
+
+  constexpr int bad_params =
+    static_cast<int>(ug::Dispatch_Error::Bad_Params);
+
+  SECTION("Params")
+  {
+    req.fn = fn0;
+    req.params = ug::make_params(6);
+    ctx = ug::Run_Context{out, fn0, 9};
+    dispatch.dispatch(req, &ctx);
+    CHECK_FALSE(ctx.is_error);
+    CHECK(var0 == 6);
+    using params_res_t = std::tuple<ug::fn_t, std::tuple<bool>, ug::id_t>;
+    CHECK(unpack_response().get().as<params_res_t>() ==
+          params_res_t(fn0, std::make_tuple(true), 9));
+  }
+  SECTION("Wrong param count")
+  {
+    req.fn = fn0;
+    req.params = ug::make_params(1, 2);
+    dispatch.dispatch(req, &ctx);
+    CHECK(ctx.is_error);
+    auto res = unpack_response().get().as<err_t>();
+    CHECK(std::get<0>(std::get<1>(res)) == bad_params);
+    CHECK(var0 == in);
+  }
+  SECTION("Wrong param type")
+  {
+    req.fn = fn0;
+    req.params = ug::make_params("Hello");
+    dispatch.dispatch(req, &ctx);
+    CHECK(ctx.is_error);
+    auto res = unpack_response().get().as<err_t>();
+    CHECK(std::get<0>(std::get<1>(res)) == bad_params);
+    CHECK(var0 == in);
+  }
+  SECTION("Unknown method")
+  {
+    req.fn = 3;
+    dispatch.dispatch(req, &ctx);
+    CHECK(ctx.is_error);
+    auto res = unpack_response().get().as<err_t>();
+    CHECK(std::get<0>(std::get<1>(res)) ==
+          static_cast<int>(ug::Dispatch_Error::Unknown_Method));
+  }
+  SECTION("Method throws")
+  {
+    constexpr int internal = static_cast<int>(ug::Dispatch_Error::Internal);
+
+    req.fn = dispatch.add_method<>("Test.Throw", []() -> int
+    {
+      throw std::runtime_error("Oops");
+    });
+    req.params = boost::none;
+    dispatch.dispatch(req, &ctx);
+    CHECK(ctx.is_error);
+    auto res = unpack_response().get().as<err_t>();
+    CHECK(std::get<1>(res) == std::make_tuple(internal, "Oops"));
+
+    req.fn = dispatch.add_method<>("Test.Throw_Int", []() -> int
+    {
+      throw 5;
+    });
+    dispatch.dispatch(req, &ctx);
+    CHECK(ctx.is_error);
+    res = unpack_response().get().as<err_t>();
+    CHECK(std::get<0>(std::get<1>(res)) == internal);
+  }
+}
+TEST_CASE("Msgpack plugin coalesces responses", "[rpclib]")
+{
+  auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& read_pipe = plugin_pipe->counterpart();
+
+  std::vector<std::vector<ug::uchar> > writes;
+  read_pipe.set_read_callback([&](auto const& buf)
+  {
+    writes.push_back(buf);
+  });
+
+  using namespace ug::literals;
+
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
+  ug::Request req;
+  req.fn = 1;
+  req.id = 5;
+
+  // Nothing should be written until we flush.
+  plugin.post_request(req);
+  plugin.post_request(req);
+  plugin.post_request(req);
+  read_pipe.step();
+  CHECK(writes.empty());
+
+  // Then all of it at once.
+  plugin.flush();
+  read_pipe.step();
+  REQUIRE(writes.size() == 1);
+  CHECK("\x92\x01\x05\x92\x01\x05\x92\x01\x05"_buf == writes[0]);
+
+  // Flushing again shouldn't write an empty buffer.
+  plugin.flush();
+  read_pipe.step();
+  CHECK(writes.size() == 1);
+
+  // Passing the threshold flushes by itself.
+  plugin.flush_threshold(6);
+  plugin.post_request(req);
+  read_pipe.step();
+  CHECK(writes.size() == 1);
+
+  plugin.post_request(req);
+  read_pipe.step();
+  REQUIRE(writes.size() == 2);
+  CHECK("\x92\x01\x05\x92\x01\x05"_buf == writes[1]);
+}
+TEST_CASE("Msgpack plugin response context", "[rpclib]")
+{
+  auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& read_pipe = plugin_pipe->counterpart();
+
+  std::vector<std::vector<ug::uchar> > writes;
+  read_pipe.set_read_callback([&](auto const& buf)
+  {
+    writes.push_back(buf);
+  });
+
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
+  ug::Req_Dispatcher dispatch;
+  auto fn = dispatch.add_method<int>("Test.Double", [](int i)
+  {
+    return i * 2;
+  });
+
+  ug::Request req;
+  req.fn = fn;
+  req.params = ug::make_params(4);
+
+  // No id, no response.
+  ug::Run_Context ctx = plugin.response_context(req);
+  CHECK_FALSE(ctx.out);
+  dispatch.dispatch(req, &ctx);
+
+  req.id = 3;
+  ctx = plugin.response_context(req);
+  dispatch.dispatch(req, &ctx);
+
+  plugin.flush();
+  read_pipe.step();
+
+  using namespace ug::literals;
+
+  // Json: [0, [8], 3]
+  REQUIRE(writes.size() == 1);
+  CHECK("\x93\x00\x91\x08\x03"_buf == writes[0]);
+}
+TEST_CASE("Msgpack plugin batches", "[rpclib]")
+{
+  auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& other_pipe = plugin_pipe->counterpart();
+
+  std::vector<std::vector<ug::uchar> > writes;
+  other_pipe.set_read_callback([&](auto const& buf)
+  {
+    writes.push_back(buf);
+  });
+
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
+  ug::Req_Dispatcher dispatch;
+  dispatch.add_method<>("Test.Zero", []() { return 0; });
+  dispatch.add_method<>("Test.One", []() { return 1; });
+  dispatch.add_method<std::string>("Test.Two",
+                                   [](std::string const&) { return 2; });
+  dispatch.add_method<>("Test.Three", []() { return 3; });
+
+  using namespace ug::literals;
+
+  // Json: [[0, [], 1], [2, ["Hello"]], "bad", [3, 2]]
+  other_pipe.write("\x94\x93\x00\x90\x01\x92\x02\x91\xa5\x48\x65\x6c\x6c\x6f"
+                   "\xa3\x62\x61\x64\x92\x03\x02"_buf);
+  // Json: [1, 3]
+  other_pipe.write("\x92\x01\x03"_buf);
+
+  std::vector<ug::Request> reqs;
+  REQUIRE(plugin.poll_requests(reqs) == 4);
+
+  CHECK(reqs[0].fn == 0);
+  CHECK(reqs[1].fn == 2);
+  CHECK(reqs[2].fn == 3);
+  CHECK(reqs[3].fn == 1);
+
+  REQUIRE(reqs[0].batch);
+  REQUIRE(reqs[1].batch);
+  REQUIRE(reqs[2].batch);
+  CHECK(*reqs[0].batch == *reqs[1].batch);
+  CHECK(*reqs[0].batch == *reqs[2].batch);
+  CHECK_FALSE(reqs[3].batch);
+
+  // The params of the batch share the zone of the frame.
+  REQUIRE(reqs[1].params);
+  CHECK(reqs[1].params->object.get().as<std::tuple<std::string> >() ==
+        std::make_tuple(std::string{"Hello"}));
+
+  for(auto const& req : reqs)
+  {
+    ug::Run_Context ctx = plugin.response_context(req);
+    dispatch.dispatch(req, &ctx);
+  }
+
+  plugin.flush();
+  other_pipe.step();
+
+  // Json: [[0, [0], 1], [3, [3], 2]] followed by [1, [1], 3]
+  REQUIRE(writes.size() == 1);
+  CHECK("\x92\x93\x00\x91\x00\x01\x93\x03\x91\x03\x02"
+        "\x93\x01\x91\x01\x03"_buf == writes[0]);
+}
+TEST_CASE("Msgpack plugin skips lots of empty batches", "[rpclib]")
+{
+  auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& other_pipe = plugin_pipe->counterpart();
+
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
+  using namespace ug::literals;
+
+  // Json: [[]] a bunch of times, then [1, 3]
+  constexpr std::size_t Empty_Batches = 200000;
+  ug::buf_t frames;
+  for(std::size_t i = 0; i < Empty_Batches; ++i)
+  {
+    frames.push_back(0x91);
+    frames.push_back(0x90);
+  }
+  auto last = "\x92\x01\x03"_buf;
+  frames.insert(frames.end(), last.begin(), last.end());
+  other_pipe.write(frames);
+
+  ug::Request req;
+  REQUIRE(plugin.poll_request(req));
+  CHECK(req.fn == 1);
+  CHECK_FALSE(req.batch);
+}
+TEST_CASE("Msgpack plugin keeps stats", "[rpclib]")
+{
+  auto plugin_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& other_pipe = plugin_pipe->counterpart();
+  other_pipe.set_read_callback([](ug::buf_t const&) {});
+
+  ug::Msgpack_Plugin plugin{std::move(plugin_pipe)};
+
+  using namespace ug::literals;
+
+  // Json: [[0, [], 1], "bad"] then [1, 3] then "bad"
+  other_pipe.write("\x92\x93\x00\x90\x01\xa3\x62\x61\x64"_buf);
+  other_pipe.write("\x92\x01\x03"_buf);
+  other_pipe.write("\xa3\x62\x61\x64"_buf);
+
+  std::vector<ug::Request> reqs;
+  REQUIRE(plugin.poll_requests(reqs, 1) == 1);
+
+  ug::Plugin_Stats stats = plugin.stats();
+  CHECK(stats.frames == 3);
+  CHECK(stats.batches == 1);
+  CHECK(stats.requests == 1);
+  CHECK(stats.bad_requests == 1);
+  CHECK(stats.queued == 2);
+  CHECK(stats.peak_queued == 3);
+  CHECK(stats.decode_time.count == 3);
+  CHECK(stats.io.reads == 3);
+  CHECK(stats.io.bytes_read == 16);
+
+  REQUIRE(plugin.poll_requests(reqs) == 1);
+  ug::Req_Dispatcher dispatch;
+  dispatch.add_method<>("Test.Zero", []() { return 0; });
+  dispatch.add_method<>("Test.One", []() { return 1; });
+  for(auto const& req : reqs)
+  {
+    ug::Run_Context ctx = plugin.response_context(req);
+    dispatch.dispatch(req, &ctx);
+  }
+  plugin.flush();
+
+  stats = plugin.stats();
+  CHECK(stats.requests == 2);
+  CHECK(stats.bad_requests == 2);
+  CHECK(stats.queued == 0);
+  CHECK(stats.flushes == 1);
+  CHECK(stats.io.writes == 1);
+  CHECK(stats.io.bytes_written == stats.bytes_flushed);
+  CHECK(stats.io.write_time.count == 1);
+
+  // They go over the wire like any other result.
+  ug::buf_t out;
+  ug::Run_Context ctx{out, 0, 1};
+  ug::set_result(&ctx, std::vector<ug::Plugin_Stats>{stats});
+  auto res = msgpack::unpack(reinterpret_cast<char const*>(out.data()),
+                             out.size());
+  auto const& result = res.get().via.array.ptr[1].via.array.ptr[0];
+  REQUIRE(result.via.array.size == 1);
+  CHECK(result.via.array.ptr[0].via.array.ptr[2].as<std::size_t>() == 2);
 }
@@ -0,0 +1,146 @@
+/*
+ * uGlue - Glue many languages together into a whole with ukernel-inspired RPC.
+ * Copyright (C) 2013  Luke San Antonio
+ *
+ * You can contact me (Luke San Antonio) at lukesanantonio@gmail.com!
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cstdlib>
+#include "catch/catch.hpp"
+#include "io/external_io.h"
+#include "rpc/plugins.h"
+#include "common/vector.h"
+
+// msgpack zones go straight to malloc, so counting operator new isn't enough.
+// On glibc we can interpose malloc itself to count every allocation made in
+// this binary, which is why it's built on its own as msgpack_plugin_bench.
+#if defined(__GLIBC__)
+  #define UG_COUNT_ALLOCS
+#endif
+
+namespace
+{
+  std::atomic<std::size_t> alloc_count_{0};
+}
+
+#ifdef UG_COUNT_ALLOCS
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* malloc(std::size_t size)
+{
+  ++alloc_count_;
+  return __libc_malloc(size);
+}
+#endif
+
+TEST_CASE("Msgpack plugin request decoding allocations",
+          "[benchmark][rpclib]")
+{
+  constexpr std::size_t Request_Count = 5000;
+
+  auto out_pipe = std::make_unique<ug::Pipe_IO>();
+  auto& write_pipe = out_pipe->counterpart();
+
+  ug::Msgpack_Plugin plugin{std::move(out_pipe)};
+
+  using namespace ug::literals;
+
+  // Json: [2, ["Hello", 5, [1, 2]], 1]
+  auto frame = "\x93\x02\x93\xa5\x48\x65\x6c\x6c\x6f\x05\x92\x01\x02\x01"_buf;
+
+  for(std::size_t i = 0; i < Request_Count; ++i) write_pipe.write(frame);
+  write_pipe.step();
+
+  // Writing to the pipe already fed the unpacker, so this only measures how
+  // the plugin turns unpacked objects into requests. Keep the params alive
+  // the way a dispatcher would until it's done with them.
+  std::vector<ug::Params> params;
+  params.reserve(Request_Count);
+
+  ug::Request req;
+  std::size_t before = alloc_count_;
+  while(plugin.poll_request(req)) params.push_back(std::move(*req.params));
+  std::size_t decode_allocs = alloc_count_ - before;
+
+  REQUIRE(params.size() == Request_Count);
+
+  // This is what we used to pay on top of that for every request: a deep
+  // copy of the params into a new zone.
+  std::vector<msgpack::object_handle> clones;
+  clones.reserve(Request_Count);
+
+  before = alloc_count_;
+  for(auto const& p : params) clones.push_back(msgpack::clone(p.object.get()));
+  std::size_t clone_allocs = alloc_count_ - before;
+
+#ifndef UG_COUNT_ALLOCS
+  WARN("Allocation counting isn't supported on this platform");
+#endif
+  WARN("Allocations decoding " << Request_Count << " requests, before: "
+       << decode_allocs + clone_allocs << ", after: " << decode_allocs);
+
+  // The params must still be intact, since they own the unpacked zone now.
+  msgpack::object const& last = params.back().object.get();
+  REQUIRE(last.type == msgpack::type::ARRAY);
+  REQUIRE(last.via.array.size == 3);
+  CHECK(last.via.array.ptr[0].as<std::string>() == "Hello");
+#ifdef UG_COUNT_ALLOCS
+  CHECK(decode_allocs == 0);
+#endif
+}
+TEST_CASE("Getter responses don't allocate", "[benchmark][rpclib]")
+{
+  constexpr std::size_t Request_Count = 5000;
+
+  // Something like Label.Get_Position.
+  ug::Vec<double> position{5.5, 6.5};
+
+  ug::Req_Dispatcher dispatch;
+  auto fn = dispatch.add_method<uint16_t>("Label.Get_Position",
+  [&position](uint16_t id) -> ug::response_result<ug::Vec<double> >
+  {
+    if(id != 1) return ug::Error_Response{4, "Invalid id"};
+    return position;
+  });
+
+  ug::Request req;
+  req.fn = fn;
+  req.id = 1;
+  req.params = ug::make_params(1);
+
+  // The output buffer is reused every frame, so it's already big enough
+  // once we are in the steady state.
+  ug::buf_t out;
+  out.reserve(Request_Count * 32);
+
+  std::size_t before = alloc_count_;
+  for(std::size_t i = 0; i < Request_Count; ++i)
+  {
+    ug::Run_Context ctx{out, req.fn, *req.id};
+    dispatch.dispatch(req, &ctx);
+  }
+  std::size_t allocs = alloc_count_ - before;
+
+  WARN("Allocations responding to " << Request_Count << " getters: "
+       << allocs);
+
+  using res_t = std::tuple<ug::fn_t, std::tuple<ug::Vec<double> >, ug::id_t>;
+  auto res = msgpack::unpack(reinterpret_cast<char const*>(out.data()),
+                             out.size());
+  CHECK(std::get<0>(std::get<1>(res.get().as<res_t>())) == position);
+#ifdef UG_COUNT_ALLOCS
+  CHECK(allocs == 0);
+#endif
+}